@@ -5,13 +5,25 @@
 #include "shadowInfo.h"
 #include "photonmap.h"
 #include "denoiser.h"
+#include "rayPacket.h"
+#include "raySort.h"
 #include <iostream>
+#include <cstdio>
 #include <thread>
 #include <atomic>
 #include <vector>
+#include <unordered_map>
 
 #define DEG2RAD(degrees) ((degrees) * M_PI / 180.0)
 
+// Occluder cache of the calling thread, one entry per light, with its counts since they were last flushed
+struct ThreadOccluders
+{
+	std::unordered_map<Light const*, Occluder> entries;
+	OcclusionStats stats;
+};
+static thread_local ThreadOccluders threadOccluders;
+
 void RayTracer::CreateCam2Wrld()
 {
 	cyVec3f cam2WrldZ = -camera.dir;
@@ -19,12 +31,39 @@ void RayTracer::CreateCam2Wrld()
 	cyVec3f cam2WrldX = cam2WrldY.Cross(cam2WrldZ);
 
 	this->cam2Wrld = cyMatrix4f(cam2WrldX, cam2WrldY, cam2WrldZ, camera.pos);
+	camX = cam2WrldX;
+	camY = cam2WrldY;
+	camZ = cam2WrldZ;
+
+	imgPlaneHeight = 2.0f * camera.focaldist * tan((DEG2RAD(camera.fov)) / 2.0f);
+	imgPlaneWidth = imgPlaneHeight * ((float)camera.imgWidth / (float)camera.imgHeight);
+}
+
+bool RayTracer::LoadScene(char const* sceneFilename)
+{
+	if (!Renderer::LoadScene(sceneFilename)) return false;
+
+	sceneBVH.Build(scene.rootNode);
+	lightBVH.Build(scene.lights);
+	return true;
+}
+
+RayTracer::~RayTracer()
+{
+	StopRender();
+	delete map;
+	delete caustics;
 }
 
 void RayTracer::BeginRender()
 {
+	StopRender();
+	// Nodes may have moved since the last render, the scene hierarchy is refit now that no worker traverses it
+	RefitScene();
+
 	renderImage.ResetNumRenderedPixels();
 	CreateCam2Wrld();
+	occlusionStats = OcclusionStats();
 
 	PhotonMap* pMap = new PhotonMap;
 	pMap->Resize(numPhotons);
@@ -33,30 +72,54 @@ void RayTracer::BeginRender()
 	cMap->Resize(numPhotons);
 
 	GeneratePhotons(pMap, cMap);
-
+#ifdef BVH_NODE_CACHE_STATS
+	NodeCacheStats::Flush();
+	NodeCacheStats photonNodes = NodeCacheStats::Take();
+	printf("Photon pass BVH node fetches: %llu, simulated cache misses: %llu\n", (unsigned long long)photonNodes.fetches, (unsigned long long)photonNodes.misses);
+#endif
+
+	delete this->map;
+	delete this->caustics;
 	this->map = pMap;
 	this->caustics = cMap;
 
-	//Multithreading
-	const int numThreads = std::thread::hardware_concurrency();
-	std::vector<std::thread> threads;
-	threads.reserve(numThreads);
-	const int tilesX = (camera.imgWidth + tileSize - 1) / tileSize;
-	const int tilesY = (camera.imgHeight + tileSize - 1) / tileSize;
-	const int totalTiles = tilesX * tilesY;
-
-	for (int t = 0; t < numThreads; t++)
-		threads.emplace_back([this, totalTiles, tilesX, tilesY]() { RunThread(this->nextTile, totalTiles, tilesX, tilesY); });
-	for (auto& th : threads) th.detach();
+	//Multithreading, one task per worker of the pool, each with its own deque of tiles
+	tiles.Init(camera.imgWidth, camera.imgHeight, tileSize, minTileSize, threadPool.GetNumThreads());
+	isRendering = true;
+
+	renderJob = threadPool.Submit(threadPool.GetNumThreads(),
+		[this](int worker, CancelToken const& cancel) { RunThread(worker, cancel); },
+		[this](bool) {
+			// A render stopped before its last tile is left as it is
+			if (renderImage.IsRenderDone()) FinishRender();
+			isRendering = false;
+		});
 }
 
 void RayTracer::StopRender()
 {
-	while (!renderImage.IsRenderDone())
+	renderJob.Cancel();
+	renderJob.Wait();
+}
+
+void RayTracer::FinishRender()
+{
 	{
-		continue;
+		std::lock_guard<std::mutex> lock(occlusionStatsMutex);
+		uint64_t blocked = occlusionStats.Blocked();
+		if (blocked > 0) {
+			printf("Shadow rays: %llu, blocked: %llu, occluder cache hits: %.1f%% (primitive %.1f%%, neighborhood %.1f%%)\n",
+				(unsigned long long)occlusionStats.rays, (unsigned long long)blocked,
+				100.0 * (occlusionStats.primitiveHits + occlusionStats.neighborhoodHits) / blocked,
+				100.0 * occlusionStats.primitiveHits / blocked, 100.0 * occlusionStats.neighborhoodHits / blocked);
+		}
 	}
 
+#ifdef BVH_NODE_CACHE_STATS
+	NodeCacheStats renderNodes = NodeCacheStats::Take();
+	printf("Render BVH node fetches: %llu, simulated cache misses: %llu\n", (unsigned long long)renderNodes.fetches, (unsigned long long)renderNodes.misses);
+#endif
+
 	//Save Raw image for comparison
 	renderImage.SaveImage("outputs/rawImage.png");
 
@@ -90,147 +153,237 @@ void RayTracer::StopRender()
 	renderImage.SaveImage("outputs/denoised.png");
 }
 
-void RayTracer::RunThread(std::atomic<int>& nextTile, int totalTiles, int tilesX, int tilesY)
+void RayTracer::RunThread(int worker, CancelToken const& cancel)
+{
+	//Precompute halton sequences up to a decent number, once per thread
+	HaltonSeq<128> halton[4] = { HaltonSeq<128>(2), HaltonSeq<128>(3), HaltonSeq<128>(5), HaltonSeq<128>(7) };
+
+	// The pool threads outlive the render, so start from an empty occluder cache
+	threadOccluders.entries.clear();
+
+	Tile tile;
+	while (!cancel.IsCancelled() && tiles.Next(worker, tile))
+	{
+		RenderTile(tile.x0, tile.y0, tile.x1, tile.y1, halton);
+		FlushOcclusionStats();
+#ifdef BVH_NODE_CACHE_STATS
+		NodeCacheStats::Flush();
+#endif
+	}
+}
+
+void RayTracer::RenderTile(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton)
+{
+	for (int y = y0; y < y1; y += blockHeight) {
+		for (int x = x0; x < x1; x += blockWidth) {
+			RenderBlock(x, y, std::min(x + blockWidth, x1), std::min(y + blockHeight, y1), halton);
+		}
+	}
+}
+
+/**
+ * Renders the pixels of a block together. Every pixel is a lane of the primary ray packet
+ * and keeps its own adaptive sampling state; converged pixels drop out of the packet, and
+ * once too few are left the rest are traced as single rays.
+ */
+void RayTracer::RenderBlock(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton)
 {
-	float l = camera.focaldist;
-	const int scrHeight = renderImage.GetHeight();
 	const int scrWidth = renderImage.GetWidth();
-	const float camWidthRes = camera.imgWidth;
-	const float camHeightRes = camera.imgHeight;
-	float wrldImgHeight = 2.0f * l * tan((DEG2RAD(camera.fov)) / 2.0f);
-	float wrldImgWidth = wrldImgHeight * (camWidthRes / camHeightRes);
 
-	for (;;)
+	int   pixelX[RAY_PACKET_SIZE], pixelY[RAY_PACKET_SIZE];
+	RNG   rng[RAY_PACKET_SIZE];
+	float randomOffset[RAY_PACKET_SIZE], randomOffsetY[RAY_PACKET_SIZE];
+	Color sumColor[RAY_PACKET_SIZE], sumColorSquared[RAY_PACKET_SIZE];
+	int   totalSamples[RAY_PACKET_SIZE];
+
+	int numLanes = 0;
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			int lane = numLanes++;
+			pixelX[lane] = x;
+			pixelY[lane] = y;
+			rng[lane] = RNG(y * scrWidth + x);
+			randomOffset[lane] = rng[lane].RandomFloat();
+			randomOffsetY[lane] = rng[lane].RandomFloat();
+			sumColor[lane] = Color(0, 0, 0);
+			sumColorSquared[lane] = Color(0, 0, 0);
+			totalSamples[lane] = maxSamples;
+		}
+	}
+	int active = (1 << numLanes) - 1;
+
+	alignas(16) float pixX[RAY_PACKET_SIZE] = {}, pixY[RAY_PACKET_SIZE] = {}, lensU[RAY_PACKET_SIZE] = {}, lensV[RAY_PACKET_SIZE] = {};
+	RayPacket packet;
+	HitInfo hit[RAY_PACKET_SIZE];
+
+	//Adaptive Sampling loop
+	for (int i = 0; i < maxSamples && active; i++)
 	{
-		const int tileIndex = nextTile.fetch_add(1, std::memory_order_relaxed);
-		if (tileIndex >= totalTiles) break;
-
-		const int tileX = tileIndex % tilesX;
-		const int tileY = tileIndex / tilesX;
-
-		//Calculate tile coords
-		const int x0 = tileX * tileSize;
-		const int y0 = tileY * tileSize;
-		const int x1 = std::min(x0 + tileSize, scrWidth);
-		const int y1 = std::min(y0 + tileSize, scrHeight);
-
-		for (int y = y0; y < y1; ++y) {
-			for (int x = x0; x < x1; ++x) {
-
-				int index = y * scrWidth + x;
-				Color sumColor(0, 0, 0);
-				Color sumColorSquared(0, 0, 0);
-
-				//Precompute halton sequences up to a decent number
-				HaltonSeq<128> haltonX(2);
-				HaltonSeq<128> haltonY(3);
-				HaltonSeq<128> haltonDiscX(5);
-				HaltonSeq<128> haltonDiscY(7);
-				RNG rng(index);
-				float randomOffset = rng.RandomFloat();
-				float randomOffsetY = rng.RandomFloat();
-				int totalSamples = 0;
-
-
-				//Adaptive Sampling loop
-				for(int i = 0; i < maxSamples; i++)
-				{
-					float haltonValueX = haltonX[i] + randomOffset;
-					if(haltonValueX > 1.0f)
-						haltonValueX -= 1.0f;
-
-					float haltonValueY = haltonY[i] + randomOffset;
-					if(haltonValueY > 1.0f)
-						haltonValueY -= 1.0f;
-
-					//Find pixel location in world space
-					float pixX = -(wrldImgWidth / 2.0f) + ((wrldImgWidth * (x + (1.0f / 2.0f)  + haltonValueX) / camWidthRes));
-					float pixY = (wrldImgHeight / 2.0f) - ((wrldImgHeight * (y + (1.0f / 2.0f) + haltonValueY) / camHeightRes));
-					cyVec3f pixelPos(pixX, pixY, -l);
-
-					//Depth of Field
-					float discX = haltonDiscX[i] + randomOffset;
-					float discY = haltonDiscY[i] + randomOffsetY;
-					if(discX > 1.0f)
-						discX -= 1.0f;
-					if (discY > 1.0f)
-						discY -= 1.0f;
-
-					//Sample camera disc
-					float r = sqrt(discX);
-					float angle = 2.0f * M_PI * discY;
-					float lensU = r * camera.dof * cos(angle);
-					float lensV = r * camera.dof * sin(angle);
-					Vec3f cameraOffset = Vec3f(lensU, lensV, 0.0f);
-					Vec3f worldCamera = cyVec3f(cam2Wrld * cyVec4f(cameraOffset, 0));
-					Vec3f worldPixel = cyVec3f(cam2Wrld * cyVec4f(pixelPos, 0));
-					Vec3f offsetCamera = camera.pos + worldCamera;
-					cyVec3f rayDir = worldPixel - worldCamera;
-
-
-					cyVec2f scrPos = cyVec2f((float)x, (float)y);
-
-					//Ray Generation 
-					Ray ray = Ray(offsetCamera, rayDir);
-
-					Color tempColor = SendRay(i, ray, scrPos, rng);
-					sumColor += tempColor;
-					sumColorSquared += tempColor * tempColor;
-
-					if (i >= minSamples)
-					{
-						//Adaptive Sampling Calculation
-						float n = (float)(i + 1);
-						Color mean = sumColor / n;
-						Color meanSq = sumColor * sumColor;
-						Color variance = (sumColorSquared - meanSq / n) / (n - 1.0f);
-						variance.ClampMin(0.0f);
-						Color stdDev = Sqrt(variance);
-						float t = tValues[(int)n - 1]; // from table
-						Color phi = t * (stdDev / sqrtf(n));
-						float threshold = 0.01f;
-
-						if (phi.r <= threshold && phi.g <= threshold && phi.b <= threshold)
-						{
-							totalSamples = i + 1;
-							break;
-						}
-					}
-
-					if (i == maxSamples)
-					{
-						totalSamples = i + 1;
-					}
-				}
+		for (int lane = 0; lane < numLanes; lane++)
+		{
+			if (!(active & (1 << lane))) continue;
 
-				Color finalColor = sumColor / (float)totalSamples;
+			SamplePixel(pixelX[lane], pixelY[lane], i, randomOffset[lane], randomOffsetY[lane], halton, pixX[lane], pixY[lane], lensU[lane], lensV[lane]);
+		}
 
-				if (camera.sRGB)
-				{
-					finalColor = finalColor.Linear2sRGB();
-				}
+		//Ray Generation
+		GeneratePrimaryRays(packet, pixX, pixY, lensU, lensV, active);
+
+		for (int lane = 0; lane < numLanes; lane++)
+		{
+			hit[lane].Init();
+			hit[lane].node = &scene.rootNode;
+		}
+		int hitMask = 0;
+		if (CountLanes(active) >= packetMinRays) hitMask = TracePacket(packet, hit);
+		else {
+			for (int lane = 0; lane < numLanes; lane++)
+				if ((active & (1 << lane)) && TraceRay(packet.Get(lane), hit[lane], HIT_FRONT)) hitMask |= 1 << lane;
+		}
 
-				renderImage.GetPixels()[index] = Color24(finalColor);
-				renderImage.IncrementNumRenderPixel(1);
-				renderImage.GetZBuffer()[index] = 0;
-				renderImage.GetSampleCount()[index] = totalSamples;
+		for (int lane = 0; lane < numLanes; lane++)
+		{
+			if (!(active & (1 << lane))) continue;
 
-				if (renderImage.IsRenderDone())
-				{
-					StopRender();
-				}
+			cyVec2f scrPos = cyVec2f((float)pixelX[lane], (float)pixelY[lane]);
+			Color tempColor = ShadePrimary(i, packet.Get(lane), hit[lane], (hitMask & (1 << lane)) != 0, scrPos, rng[lane]);
+			sumColor[lane] += tempColor;
+			sumColorSquared[lane] += tempColor * tempColor;
+
+			if (IsConverged(sumColor[lane], sumColorSquared[lane], i))
+			{
+				totalSamples[lane] = i + 1;
+				active &= ~(1 << lane);
 			}
 		}
 	}
+
+	for (int lane = 0; lane < numLanes; lane++)
+	{
+		StorePixel(pixelX[lane], pixelY[lane], sumColor[lane], totalSamples[lane]);
+	}
+	renderImage.IncrementNumRenderPixel(numLanes);
 }
 
-Color RayTracer::SendRay(int index, Ray ray, cyVec2f scrPos, RNG rng)
+void RayTracer::SamplePixel(int x, int y, int i, float randomOffset, float randomOffsetY, HaltonSeq<128> const* halton, float& pixX, float& pixY, float& lensU, float& lensV) const
 {
-	HitInfo hit;
-	hit.Init();
-	hit.node = &scene.rootNode;
+	float haltonValueX = halton[0][i] + randomOffset;
+	if (haltonValueX > 1.0f)
+		haltonValueX -= 1.0f;
+
+	float haltonValueY = halton[1][i] + randomOffset;
+	if (haltonValueY > 1.0f)
+		haltonValueY -= 1.0f;
+
+	//Find pixel location on the image plane
+	pixX = -(imgPlaneWidth / 2.0f) + ((imgPlaneWidth * (x + (1.0f / 2.0f) + haltonValueX) / (float)camera.imgWidth));
+	pixY = (imgPlaneHeight / 2.0f) - ((imgPlaneHeight * (y + (1.0f / 2.0f) + haltonValueY) / (float)camera.imgHeight));
+
+	//Depth of Field
+	float discX = halton[2][i] + randomOffset;
+	float discY = halton[3][i] + randomOffsetY;
+	if (discX > 1.0f)
+		discX -= 1.0f;
+	if (discY > 1.0f)
+		discY -= 1.0f;
+
+	//Sample camera disc
+	float r = sqrt(discX);
+	float angle = 2.0f * M_PI * discY;
+	lensU = r * camera.dof * cos(angle);
+	lensV = r * camera.dof * sin(angle);
+}
 
-	if (TraceRay(ray, hit, HIT_FRONT))
+bool RayTracer::IsConverged(Color const& sumColor, Color const& sumColorSquared, int i) const
+{
+	if (i < minSamples) return false;
+
+	//Adaptive Sampling Calculation
+	float n = (float)(i + 1);
+	Color meanSq = sumColor * sumColor;
+	Color variance = (sumColorSquared - meanSq / n) / (n - 1.0f);
+	variance.ClampMin(0.0f);
+	Color stdDev = Sqrt(variance);
+	float t = tValues[std::min((int)n - 1, 70)]; // from table, the last entry stands for every larger sample count
+	Color phi = t * (stdDev / sqrtf(n));
+	float threshold = 0.01f;
+
+	return phi.r <= threshold && phi.g <= threshold && phi.b <= threshold;
+}
+
+void RayTracer::StorePixel(int x, int y, Color const& sumColor, int totalSamples)
+{
+	int index = y * renderImage.GetWidth() + x;
+	Color finalColor = sumColor / (float)totalSamples;
+
+	if (camera.sRGB)
+	{
+		finalColor = finalColor.Linear2sRGB();
+	}
+
+	renderImage.GetPixels()[index] = Color24(finalColor);
+	renderImage.GetZBuffer()[index] = 0;
+	renderImage.GetSampleCount()[index] = totalSamples;
+}
+
+/**
+ * Turns image plane positions and lens offsets into world space rays, four lanes at a time.
+ * The rotation part of cam2Wrld is applied as a weighted sum of the camera axes, which is
+ * all the two matrix products of a single camera ray amount to.
+ */
+void RayTracer::GeneratePrimaryRays(RayPacket& packet, float const* pixX, float const* pixY, float const* lensU, float const* lensV, int active) const
+{
+	packet.active = active;
+#if SIMD_X86
+	for (int h = 0; h < RAY_PACKET_SIZE; h += 4)
+	{
+		__m128 u = _mm_load_ps(lensU + h);
+		__m128 v = _mm_load_ps(lensV + h);
+		__m128 du = _mm_sub_ps(_mm_load_ps(pixX + h), u);
+		__m128 dv = _mm_sub_ps(_mm_load_ps(pixY + h), v);
+		__m128 dw = _mm_set1_ps(-camera.focaldist);
+
+		float* origin[3] = { packet.px + h, packet.py + h, packet.pz + h };
+		float* dir[3] = { packet.dx + h, packet.dy + h, packet.dz + h };
+		float* invDir[3] = { packet.invDx + h, packet.invDy + h, packet.invDz + h };
+		float* pInvDir[3] = { packet.pInvDx + h, packet.pInvDy + h, packet.pInvDz + h };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m128 x = _mm_set1_ps(camX[axis]), y = _mm_set1_ps(camY[axis]), z = _mm_set1_ps(camZ[axis]);
+			__m128 p = _mm_add_ps(_mm_set1_ps(camera.pos[axis]), _mm_add_ps(_mm_mul_ps(x, u), _mm_mul_ps(y, v)));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, du), _mm_mul_ps(y, dv)), _mm_mul_ps(z, dw));
+			_mm_store_ps(origin[axis], p);
+			_mm_store_ps(dir[axis], d);
+			__m128 inv = SafeReciprocal4(d);
+			_mm_store_ps(invDir[axis], inv);
+			_mm_store_ps(pInvDir[axis], _mm_mul_ps(p, inv));
+		}
+	}
+#else
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		Vec3f p = camera.pos + camX * lensU[lane] + camY * lensV[lane];
+		Vec3f d = camX * (pixX[lane] - lensU[lane]) + camY * (pixY[lane] - lensV[lane]) - camZ * camera.focaldist;
+		packet.Set(lane, Ray(p, d));
+	}
+	packet.active = active;
+#endif
+}
+
+// Closest hits of the packet lanes against the scene hierarchy and the renderable lights
+int RayTracer::TracePacket(RayPacket const& packet, HitInfo* hInfo, int hitSide) const
+{
+	int hitMask = sceneBVH.IntersectPacket(packet, hInfo, hitSide);
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		if ((packet.active & (1 << lane)) && TraceLights(packet.Get(lane), hInfo[lane])) hitMask |= 1 << lane;
+	}
+	return hitMask;
+}
+
+Color RayTracer::ShadePrimary(int index, Ray const& ray, HitInfo& hit, bool hitAny, cyVec2f scrPos, RNG rng)
+{
+	if (hitAny)
 	{
 		ShadowInfo info = ShadowInfo(scene.lights, scene.environment, rng, this);
 		info.SetPixelSample(index);
@@ -250,12 +403,10 @@ Color RayTracer::SendRay(int index, Ray ray, cyVec2f scrPos, RNG rng)
 			}
 		}
 	}
-	else
-	{
-		float u = scrPos.x / (float)camera.imgWidth;
-		float v = scrPos.y / (float)camera.imgHeight;
-		return scene.background.Eval(Vec3f(u, v, 0.0));
-	}
+
+	float u = scrPos.x / (float)camera.imgWidth;
+	float v = scrPos.y / (float)camera.imgHeight;
+	return scene.background.Eval(Vec3f(u, v, 0.0));
 }
 
 
@@ -274,16 +425,21 @@ void RayTracer::GeneratePhotons(PhotonMap* pMap, PhotonMap* cMap) {
 	size_t idx = 0;
 	const size_t n = photonLights.size();
 
-	while ((pMap->RemainingSpace() > 0 || cMap->RemainingSpace() > 0) && n > 0) {
-		Light* light = photonLights[idx];
+	if (sortRays && n > 0) {
+		GeneratePhotonBatches(photonLights, rng, pMap, cMap);
+	}
+	else {
+		while ((pMap->RemainingSpace() > 0 || cMap->RemainingSpace() > 0) && n > 0) {
+			Light* light = photonLights[idx];
 
-		light->RandomPhoton(rng, ray, c);
-		HitInfo info;
-		DirSampler::Info si;
-		si.lobe = DirSampler::Lobe::NONE;
-		TracePhoton(ray, info, c, pMap, cMap, si);
+			light->RandomPhoton(rng, ray, c);
+			HitInfo info;
+			DirSampler::Info si;
+			si.lobe = DirSampler::Lobe::NONE;
+			TracePhoton(ray, info, c, pMap, cMap, si);
 
-		idx = (idx + 1) % n;
+			idx = (idx + 1) % n;
+		}
 	}
 
 
@@ -293,39 +449,60 @@ void RayTracer::GeneratePhotons(PhotonMap* pMap, PhotonMap* cMap) {
 	cMap->PrepareForIrradianceEstimation();
 }
 
-bool RayTracer::TracePhoton(const Ray &ray, HitInfo& hInfo, Color& c, PhotonMap* pMap, PhotonMap* cMap, DirSampler::Info si){
-	if (TraverseTree(ray, &scene.rootNode, hInfo, HIT_FRONT)) {
-		RNG rng(rand());
-		if (hInfo.node) {
+/**
+ * Emits photons in batches and traces each batch one bounce at a time. The rays of every
+ * bounce are sorted by direction octant and origin first, so consecutive rays walk the
+ * same part of the hierarchies. The last batch may trace a few photons that no longer fit.
+ */
+void RayTracer::GeneratePhotonBatches(std::vector<Light*> const& photonLights, RNG& rng, PhotonMap* pMap, PhotonMap* cMap) {
+	struct PhotonPath {
+		Ray ray;
+		Color c;
+		DirSampler::Info si;
+	};
 
-			DirSampler::Lobe prevLobe = si.lobe;
-			
+	std::vector<PhotonPath> batch, next;
+	std::vector<std::pair<uint64_t, uint32_t>> order;
+	size_t idx = 0;
 
-			SamplerInfo sInfo(rng);
-			sInfo.SetHit(ray, hInfo);
-			Vec3f newDir;
+	while (pMap->RemainingSpace() > 0 || cMap->RemainingSpace() > 0) {
+		batch.resize(photonBatchSize);
+		for (PhotonPath& path : batch) {
+			photonLights[idx]->RandomPhoton(rng, path.ray, path.c);
+			path.si.lobe = DirSampler::Lobe::NONE;
+			idx = (idx + 1) % photonLights.size();
+		}
 
-			if (hInfo.node->GetMaterial()->GenerateSample(sInfo, newDir, si))
-			{
-				Color newC = c * si.mult / si.prob;
-				Ray photonRay(hInfo.p, newDir);
-
-				if (si.lobe & DirSampler::Lobe::DIFFUSE) {
-					if ((prevLobe & DirSampler::Lobe::TRANSMISSION) || (prevLobe & DirSampler::Lobe::SPECULAR)) {
-						if (cMap->RemainingSpace() > 0)
-							cMap->AddPhoton(sInfo.P(), -photonRay.dir, newC);
-					}
-					else {
-						if (pMap->RemainingSpace() > 0)
-							pMap->AddPhoton(sInfo.P(), -photonRay.dir, newC);
-					}
-				}
+		while (!batch.empty() && (pMap->RemainingSpace() > 0 || cMap->RemainingSpace() > 0)) {
+			SortRays(batch.size(), [&batch](size_t i) -> Ray const& { return batch[i].ray; }, order);
+			next.clear();
+			for (auto const& key : order) {
+				PhotonPath const& path = batch[key.second];
+				HitInfo hInfo;
+				if (!TraceRay(path.ray, hInfo, HIT_FRONT)) continue;
+				RNG hitRng(rand());
+				if (!hInfo.node) continue;
+
+				PhotonPath out;
+				out.si = path.si;
+				if (ScatterPhoton(path.ray, hInfo, path.c, out.si, pMap, cMap, hitRng, out.ray, out.c)) next.push_back(out);
+			}
+			batch.swap(next);
+		}
+	}
+}
 
+bool RayTracer::TracePhoton(const Ray &ray, HitInfo& hInfo, Color& c, PhotonMap* pMap, PhotonMap* cMap, DirSampler::Info si){
+	if (TraceRay(ray, hInfo, HIT_FRONT)) {
+		RNG rng(rand());
+		if (hInfo.node) {
+			Ray photonRay;
+			Color newC;
+			if (ScatterPhoton(ray, hInfo, c, si, pMap, cMap, rng, photonRay, newC))
+			{
 				HitInfo newHInfo;
 				TracePhoton(photonRay, newHInfo, newC, pMap, cMap, si);
 			}
-
-
 			return true;
 		}
 	}
@@ -333,99 +510,54 @@ bool RayTracer::TracePhoton(const Ray &ray, HitInfo& hInfo, Color& c, PhotonMap*
 	return false;
 }
 
-bool RayTracer::TraceRay(Ray const& ray, HitInfo& hInfo, int hitSide) const
-{
-	return TraverseTree(ray, &scene.rootNode, hInfo, hitSide);
-}
+bool RayTracer::ScatterPhoton(Ray const& ray, HitInfo const& hInfo, Color const& c, DirSampler::Info& si, PhotonMap* pMap, PhotonMap* cMap, RNG& rng, Ray& photonRay, Color& newC) {
+	DirSampler::Lobe prevLobe = si.lobe;
 
-bool RayTracer::TraceShadowRay(Ray const& ray, float t_max, int hitSide) const
-{
-	return TraverseTreeShadow(ray, &scene.rootNode, t_max);
-}
+	SamplerInfo sInfo(rng);
+	sInfo.SetHit(ray, hInfo);
+	Vec3f newDir;
 
-bool RayTracer::TraverseTreeShadow(const Ray& ray, const Node* node, float t_max) const
-{
-	if (!node) return false;
-	Ray transformedRay = node->ToNodeCoords(ray);
+	if (!hInfo.node->GetMaterial()->GenerateSample(sInfo, newDir, si)) return false;
 
-	// Check current node's object
-	const Object* obj = node->GetNodeObj();
-	if (obj)
-	{
-		if (obj->ShadowRay(transformedRay, t_max))
-		{
-			return true;
-		}
-	}
+	newC = c * si.mult / si.prob;
+	photonRay = Ray(hInfo.p, newDir);
 
-	// Traverse children
-	for (int i = 0; i < node->GetNumChild(); i++)
-	{
-		if (TraverseTreeShadow(transformedRay, node->GetChild(i), t_max))
-		{
-			return true;
+	if (si.lobe & DirSampler::Lobe::DIFFUSE) {
+		if ((prevLobe & DirSampler::Lobe::TRANSMISSION) || (prevLobe & DirSampler::Lobe::SPECULAR)) {
+			if (cMap->RemainingSpace() > 0)
+				cMap->AddPhoton(sInfo.P(), -photonRay.dir, newC);
+		}
+		else {
+			if (pMap->RemainingSpace() > 0)
+				pMap->AddPhoton(sInfo.P(), -photonRay.dir, newC);
 		}
 	}
+	return true;
+}
 
-	return false;
+bool RayTracer::TraceRay(Ray const& ray, HitInfo& hInfo, int hitSide) const
+{
+	bool hit = sceneBVH.IntersectRay(ray, hInfo, hitSide);
+	if (TraceLights(ray, hInfo)) hit = true;
+	return hit;
 }
 
-bool RayTracer::TraverseTree(const Ray& ray, const Node* node, HitInfo& hitInfo, int hitSide) const
+bool RayTracer::TraceLights(Ray const& ray, HitInfo& hInfo) const
 {
-	if (!node) return false;
 	bool hit = false;
-	Ray transformedRay = node->ToNodeCoords(ray);
-
-	// Check current node's object
-	const Object* obj = node->GetNodeObj();
-	if (obj)
+	for (const auto& light : scene.lights)
 	{
-		HitInfo localHit;
-		localHit.Init();
-		if (obj->IntersectRay(transformedRay, localHit, hitSide))
+		if (light->IsRenderable())
 		{
-			if (localHit.z < hitInfo.z)
+			HitInfo localHit;
+			localHit.Init();
+			if (light->IntersectRay(ray, localHit, HIT_FRONT_AND_BACK))
 			{
-				hitInfo = localHit;
-				hit = true;
-				node->FromNodeCoords(hitInfo);
-				hitInfo.node = node;
-			}
-		}
-	}
-
-	// Traverse children
-	for (int i = 0; i < node->GetNumChild(); i++)
-	{
-		HitInfo localHit;
-		localHit.Init();
-		if (TraverseTree(transformedRay, node->GetChild(i), localHit, hitSide))
-		{
-			if(localHit.z < hitInfo.z)
-			{
-				hitInfo = localHit;
-				hit = true;
-				node->FromNodeCoords(hitInfo);
-			}
-		}
-	}
-
-	if(node == &scene.rootNode)
-	{
-		for(const auto& light : scene.lights)
-		{
-			if (light->IsRenderable())
-			{
-				HitInfo localHit;
-				localHit.Init();
-				if (light->IntersectRay(ray, localHit, HIT_FRONT_AND_BACK))
+				if (localHit.z < hInfo.z)
 				{
-					if (localHit.z < hitInfo.z)
-					{
-						hitInfo = localHit;
-						hit = true;
-						hitInfo.light = true;
-					}
+					hInfo = localHit;
+					hit = true;
+					hInfo.light = true;
 				}
 			}
 		}
@@ -433,3 +565,25 @@ bool RayTracer::TraverseTree(const Ray& ray, const Node* node, HitInfo& hitInfo,
 
 	return hit;
 }
+
+bool RayTracer::TraceShadowRay(Ray const& ray, float t_max, int hitSide) const
+{
+	return sceneBVH.ShadowRay(ray, t_max);
+}
+
+bool RayTracer::TraceShadowRay(Ray const& ray, float t_max, Light const* light) const
+{
+	return sceneBVH.ShadowRay(ray, t_max, threadOccluders.entries[light], threadOccluders.stats);
+}
+
+// Adds the occluder cache counts of the calling thread to the totals of the render
+void RayTracer::FlushOcclusionStats()
+{
+	OcclusionStats& stats = threadOccluders.stats;
+	std::lock_guard<std::mutex> lock(occlusionStatsMutex);
+	occlusionStats.rays += stats.rays;
+	occlusionStats.primitiveHits += stats.primitiveHits;
+	occlusionStats.neighborhoodHits += stats.neighborhoodHits;
+	occlusionStats.traversalHits += stats.traversalHits;
+	stats = OcclusionStats();
+}
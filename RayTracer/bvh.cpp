@@ -0,0 +1,864 @@
+///
+/// \file       bvh.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the SAH bounding volume hierarchy defined in bvh.h
+///
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "bvh.h"
+
+static void SetNodeBounds(float* bounds, Box const& box)
+{
+	bounds[0] = box.pmin.x; bounds[1] = box.pmin.y; bounds[2] = box.pmin.z;
+	bounds[3] = box.pmax.x; bounds[4] = box.pmax.y; bounds[5] = box.pmax.z;
+}
+
+void SAHBVH::Clear()
+{
+	nodes.clear();
+	elements.clear();
+	mapping.reset();
+	nodeData = nullptr;
+	elementData = nullptr;
+	numNodes = numElements = 0;
+	sahCost = 0.0f;
+}
+
+void SAHBVH::UseOwnedStorage()
+{
+	nodeData = nodes.data();
+	numNodes = (unsigned int)nodes.size();
+	elementData = elements.data();
+	numElements = (unsigned int)elements.size();
+}
+
+void SAHBVH::ReleaseNodes()
+{
+	nodes.clear();
+	nodes.shrink_to_fit();
+	nodeData = nullptr;
+}
+
+void SAHBVH::Attach(std::shared_ptr<MappedFile> const& file, LinearBVHNode* nodeArray, unsigned int nodeCount,
+                    unsigned int* elementArray, unsigned int elementCount, float cost, BVHBuildParams const& params)
+{
+	Clear();
+	mapping = file;
+	nodeData = nodeArray;
+	numNodes = nodeCount;
+	elementData = elementArray;
+	numElements = elementCount;
+	sahCost = cost;
+	buildParams = params;
+}
+
+//-------------------------------------------------------------------------------
+// Threading
+//-------------------------------------------------------------------------------
+
+// Smallest subtree handed to another thread, below this the thread start costs more than it saves
+#define BVH_PARALLEL_SUBTREE 4096
+
+// Elements per chunk when the binning of a large node is spread over threads
+#define BVH_PARALLEL_CHUNK 32768
+
+static int GetBuildThreadCount(BVHBuildParams const& params)
+{
+	if (params.numThreads > 0) return params.numThreads;
+	return std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+// Takes up to wanted threads from the build's spare threads and returns how many it got
+static int TakeThreads(std::atomic<int>& spareThreads, int wanted)
+{
+	int spare = spareThreads.load();
+	while (spare > 0 && wanted > 0)
+	{
+		int taken = std::min(spare, wanted);
+		if (spareThreads.compare_exchange_weak(spare, spare - taken)) return taken;
+	}
+	return 0;
+}
+
+// Runs fn(chunk, begin, end) over numChunks equal slices of [first, first+count), slice 0 on the calling thread
+template <typename F>
+static void ForEachChunk(int numChunks, unsigned int first, unsigned int count, F const& fn)
+{
+	auto bound = [&](int c) { return first + (unsigned int)((unsigned long long)count * c / numChunks); };
+	std::vector<std::thread> threads;
+	threads.reserve(numChunks - 1);
+	for (int c = 1; c < numChunks; c++) threads.emplace_back(fn, c, bound(c), bound(c + 1));
+	fn(0, bound(0), bound(1));
+	for (std::thread& t : threads) t.join();
+}
+
+// Takes spare threads for the loops over a large node and returns how many slices to split them into.
+// The threads are given back with EndChunks.
+static int BeginChunks(std::atomic<int>& spareThreads, unsigned int count)
+{
+	if (count < 2 * BVH_PARALLEL_CHUNK) return 1;
+	return 1 + TakeThreads(spareThreads, (int)(count / BVH_PARALLEL_CHUNK) - 1);
+}
+
+static void EndChunks(std::atomic<int>& spareThreads, int numChunks)
+{
+	spareThreads += numChunks - 1;
+}
+
+// Builds two subtrees, the first on a new thread if the subtree is large and the build has a thread to spare
+template <typename F1, typename F2>
+static void BuildSubtrees(std::atomic<int>& spareThreads, unsigned int firstCount, F1 const& first, F2 const& second)
+{
+	if (firstCount >= BVH_PARALLEL_SUBTREE && TakeThreads(spareThreads, 1) == 1)
+	{
+		std::thread t(first);
+		second();
+		t.join();
+		spareThreads++;
+	}
+	else
+	{
+		first();
+		second();
+	}
+}
+
+// Per-axis bins of the object split search
+struct ObjectBin
+{
+	Box bound;
+	unsigned int count = 0;
+};
+
+//-------------------------------------------------------------------------------
+// Object splits
+//-------------------------------------------------------------------------------
+
+struct SAHBVH::ObjectBuild
+{
+	std::vector<Box> const&   bounds;
+	std::vector<Vec3f> const& centers;
+	BVHBuildParams const&     params;
+	std::vector<BuildNode>&   buildNodes;	// allocated up front, so threads can fill disjoint nodes
+	std::atomic<unsigned int> numBuildNodes;
+	std::atomic<int>          spareThreads;
+};
+
+/**
+ * Builds the hierarchy top-down, choosing each split among binCount candidate planes
+ * per axis by the surface area heuristic. Subtrees are built as parallel tasks and the
+ * binning of the large nodes near the root is split across threads; the splits do not
+ * depend on the number of threads.
+ *
+ * @param elementBounds  Bounding box of every element, indexed by element ID.
+ * @param params         Bin count and cost constants for the heuristic.
+ */
+void SAHBVH::Build(std::vector<Box> const& elementBounds, BVHBuildParams const& params)
+{
+	Clear();
+	buildParams = params;
+	// Leaves must fit the 16-bit count, so nodes above it are always split
+	buildParams.maxLeafSize = std::min(params.maxLeafSize, (unsigned int)BVH_MAX_LEAF_COUNT);
+
+	const unsigned int n = (unsigned int)elementBounds.size();
+	if (n == 0) return;
+
+	std::vector<BuildNode> buildNodes(2 * n - 1);
+	std::vector<Vec3f> centers(n);
+	ObjectBuild build = { elementBounds, centers, buildParams, buildNodes, { 1 }, { GetBuildThreadCount(params) - 1 } };
+
+	elements.resize(n);
+	const int numChunks = BeginChunks(build.spareThreads, n);
+	ForEachChunk(numChunks, 0, n, [&](int, unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			elements[i] = i;
+			centers[i] = (elementBounds[i].pmin + elementBounds[i].pmax) * 0.5f;
+		}
+	});
+	EndChunks(build.spareThreads, numChunks);
+
+	buildNodes[0].first = 0;
+	buildNodes[0].count = n;
+	Subdivide(build, 0, 1);
+
+	nodes.reserve(build.numBuildNodes);
+	Flatten(buildNodes, 0, nullptr);
+	UseOwnedStorage();
+	ComputeSAHCost();
+}
+
+void SAHBVH::Subdivide(ObjectBuild& build, unsigned int nodeID, unsigned int depth)
+{
+	std::vector<Box> const& bounds = build.bounds;
+	std::vector<Vec3f> const& centers = build.centers;
+	BVHBuildParams const& params = build.params;
+	BuildNode& node = build.buildNodes[nodeID];
+	const unsigned int first = node.first;
+	const unsigned int count = node.count;
+
+	// Large nodes near the root split their loops over the elements across threads
+	const int numChunks = BeginChunks(build.spareThreads, count);
+
+	Box nodeBound, centerBound;
+	{
+		std::vector<Box> chunkBounds(2 * numChunks);
+		ForEachChunk(numChunks, first, count, [&](int c, unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				chunkBounds[2 * c] += bounds[elements[i]];
+				chunkBounds[2 * c + 1] += centers[elements[i]];
+			}
+		});
+		for (int c = 0; c < numChunks; c++)
+		{
+			nodeBound += chunkBounds[2 * c];
+			centerBound += chunkBounds[2 * c + 1];
+		}
+	}
+	node.bound = nodeBound;
+
+	if (count == 1 || depth >= BVH_MAX_DEPTH)
+	{
+		EndChunks(build.spareThreads, numChunks);
+		return;
+	}
+
+	// One set of bins per axis and per chunk, the chunks are merged into the first set
+	const int binCount = std::max(params.binCount, 2);
+	std::vector<ObjectBin> bins(3 * binCount * numChunks);
+	float binScale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = centerBound.pmax[axis] - centerBound.pmin[axis];
+		binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+	}
+	ForEachChunk(numChunks, first, count, [&](int c, unsigned int begin, unsigned int end)
+	{
+		ObjectBin* chunkBins = &bins[3 * binCount * c];
+		for (unsigned int i = begin; i < end; i++)
+		{
+			unsigned int e = elements[i];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int b = std::min((int)((centers[e][axis] - centerBound.pmin[axis]) * binScale[axis]), binCount - 1);
+				chunkBins[axis * binCount + b].count++;
+				chunkBins[axis * binCount + b].bound += bounds[e];
+			}
+		}
+	});
+	EndChunks(build.spareThreads, numChunks);
+	for (int c = 1; c < numChunks; c++)
+	{
+		for (int b = 0; b < 3 * binCount; b++)
+		{
+			bins[b].count += bins[3 * binCount * c + b].count;
+			bins[b].bound += bins[3 * binCount * c + b].bound;
+		}
+	}
+
+	std::vector<float> rightArea(binCount);
+	std::vector<unsigned int> rightCount(binCount);
+
+	const float leafCost = params.leafCost * count;
+	const float invArea = 1.0f / std::max(SurfaceArea(nodeBound), 1e-20f);
+	float bestCost = BIGFLOAT;
+	int bestAxis = -1, bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (binScale[axis] == 0.0f) continue;
+		ObjectBin const* axisBins = &bins[axis * binCount];
+
+		// Sweep from the right to get the area and count of everything right of each plane
+		Box right;
+		unsigned int numRight = 0;
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			right += axisBins[b].bound;
+			numRight += axisBins[b].count;
+			rightArea[b] = SurfaceArea(right);
+			rightCount[b] = numRight;
+		}
+
+		// Sweep from the left, the split plane b separates bins [0,b) from [b,binCount)
+		Box left;
+		unsigned int numLeft = 0;
+		for (int b = 1; b < binCount; b++)
+		{
+			left += axisBins[b - 1].bound;
+			numLeft += axisBins[b - 1].count;
+			if (numLeft == 0 || rightCount[b] == 0) continue;
+
+			float cost = params.traversalCost + params.leafCost * (SurfaceArea(left) * numLeft + rightArea[b] * rightCount[b]) * invArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	unsigned int mid;
+	if (bestAxis >= 0 && count > params.maxLeafSize && depth + 16 >= BVH_MAX_DEPTH)
+	{
+		// Close to the depth limit, split at the median so the remaining levels can still fit the leaf counts in 16 bits
+		mid = count / 2;
+		std::nth_element(elements.begin() + first, elements.begin() + first + mid, elements.begin() + first + count,
+			[&](unsigned int a, unsigned int b) { return centers[a][bestAxis] < centers[b][bestAxis]; });
+	}
+	else if (bestAxis >= 0 && (bestCost < leafCost || count > params.maxLeafSize))
+	{
+		const float cmin = centerBound.pmin[bestAxis];
+		const float scale = binScale[bestAxis];
+		auto split = std::partition(elements.begin() + first, elements.begin() + first + count,
+			[&](unsigned int e) { return std::min((int)((centers[e][bestAxis] - cmin) * scale), binCount - 1) < bestSplit; });
+		mid = (unsigned int)(split - (elements.begin() + first));
+	}
+	else if (count > params.maxLeafSize)
+	{
+		// Every center is in the same spot, so no plane separates them; split the list in half to keep leaves small
+		mid = count / 2;
+	}
+	else return;
+
+	const unsigned int child = build.numBuildNodes.fetch_add(2);
+	build.buildNodes[child].first = first;
+	build.buildNodes[child].count = mid;
+	build.buildNodes[child + 1].first = first + mid;
+	build.buildNodes[child + 1].count = count - mid;
+	node.first = child;
+	node.count = 0;
+	node.axis = std::max(bestAxis, 0);
+
+	BuildSubtrees(build.spareThreads, mid,
+		[&, child, depth]() { Subdivide(build, child, depth + 1); },
+		[&, child, depth]() { Subdivide(build, child + 1, depth + 1); });
+}
+
+//-------------------------------------------------------------------------------
+// Spatial splits
+//-------------------------------------------------------------------------------
+
+struct SAHBVH::SpatialBuild
+{
+	std::vector<Vec3f> const& verts;
+	BVHBuildParams const&     params;
+	float                     minOverlap;		// child overlap area above which spatial splits are tried
+	std::vector<BuildNode>&   buildNodes;		// allocated up front, so threads can fill disjoint nodes
+	std::atomic<unsigned int> numBuildNodes;
+	std::atomic<int>          spareThreads;
+	std::vector<unsigned int> leafElements{};	// leaf references in the order the leaves are finished, put in tree order by Flatten
+	std::mutex                leafMutex{};
+};
+
+// Returns the bounding box of the part of the triangle between lo and hi along the axis, clipped to the given box
+static Box ClipTriangle(Vec3f const* v, int axis, float lo, float hi, Box const& clip)
+{
+	Box b;
+	for (int i = 0; i < 3; i++)
+	{
+		Vec3f const& p0 = v[i];
+		Vec3f const& p1 = v[(i + 1) % 3];
+		if (p0[axis] >= lo && p0[axis] <= hi) b += p0;
+
+		const float planes[2] = { lo, hi };
+		for (float plane : planes)
+		{
+			if ((p0[axis] < plane && p1[axis] > plane) || (p0[axis] > plane && p1[axis] < plane))
+			{
+				Vec3f p = p0 + (p1 - p0) * ((plane - p0[axis]) / (p1[axis] - p0[axis]));
+				p[axis] = plane;
+				b += p;
+			}
+		}
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		b.pmin[i] = std::max(b.pmin[i], clip.pmin[i]);
+		b.pmax[i] = std::min(b.pmax[i], clip.pmax[i]);
+	}
+	return b;
+}
+
+static Box Overlap(Box const& a, Box const& b)
+{
+	Box o;
+	for (int i = 0; i < 3; i++)
+	{
+		o.pmin[i] = std::max(a.pmin[i], b.pmin[i]);
+		o.pmax[i] = std::min(a.pmax[i], b.pmax[i]);
+	}
+	return o;
+}
+
+/**
+ * Builds the hierarchy over triangle references, considering spatial splits next to the
+ * binned object splits (Stich et al., "Spatial Splits in Bounding Volume Hierarchies").
+ * The duplicate budget is shared out to the children by reference count, so subtrees can
+ * be built in parallel and the result does not depend on the number of threads.
+ *
+ * @param triangleVerts  Three vertices per triangle, the element ID is the triangle index.
+ * @param params         Bin count, cost constants and the spatial split limits.
+ */
+void SAHBVH::BuildSpatial(std::vector<Vec3f> const& triangleVerts, BVHBuildParams const& params)
+{
+	Clear();
+	buildParams = params;
+	buildParams.maxLeafSize = std::min(params.maxLeafSize, (unsigned int)BVH_MAX_LEAF_COUNT);
+
+	const unsigned int n = (unsigned int)(triangleVerts.size() / 3);
+	if (n == 0) return;
+
+	std::vector<Reference> refs(n);
+	Box rootBound;
+	for (unsigned int i = 0; i < n; i++)
+	{
+		refs[i].element = i;
+		for (int k = 0; k < 3; k++) refs[i].bound += triangleVerts[3 * i + k];
+		rootBound += refs[i].bound;
+	}
+
+	// Every leaf holds at least one reference and there are at most n plus the budget of them
+	const int duplicateBudget = (int)(params.duplicateBudget * n);
+	std::vector<BuildNode> buildNodes(2 * (n + std::max(duplicateBudget, 0)));
+	SpatialBuild build = { triangleVerts, buildParams, params.spatialAlpha * SurfaceArea(rootBound), buildNodes, { 1 }, { GetBuildThreadCount(params) - 1 } };
+	build.leafElements.reserve(n);
+
+	SubdivideSpatial(build, 0, refs, 1, duplicateBudget);
+
+	nodes.reserve(build.numBuildNodes);
+	elements.reserve(build.leafElements.size());
+	Flatten(buildNodes, 0, build.leafElements.data());
+	UseOwnedStorage();
+	ComputeSAHCost();
+}
+
+void SAHBVH::SubdivideSpatial(SpatialBuild& build, unsigned int nodeID, std::vector<Reference>& refs, unsigned int depth, int duplicateBudget)
+{
+	BVHBuildParams const& params = build.params;
+	BuildNode& node = build.buildNodes[nodeID];
+	const unsigned int count = (unsigned int)refs.size();
+
+	// Large nodes near the root split their loops over the references across threads
+	const int numChunks = BeginChunks(build.spareThreads, count);
+
+	Box nodeBound, centerBound;
+	{
+		std::vector<Box> chunkBounds(2 * numChunks);
+		ForEachChunk(numChunks, 0, count, [&](int c, unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				chunkBounds[2 * c] += refs[i].bound;
+				chunkBounds[2 * c + 1] += (refs[i].bound.pmin + refs[i].bound.pmax) * 0.5f;
+			}
+		});
+		for (int c = 0; c < numChunks; c++)
+		{
+			nodeBound += chunkBounds[2 * c];
+			centerBound += chunkBounds[2 * c + 1];
+		}
+	}
+	node.bound = nodeBound;
+
+	auto makeLeaf = [&]()
+	{
+		std::lock_guard<std::mutex> lock(build.leafMutex);
+		node.first = (unsigned int)build.leafElements.size();
+		node.count = count;
+		for (Reference const& r : refs) build.leafElements.push_back(r.element);
+	};
+
+	if (count == 1 || depth >= BVH_MAX_DEPTH)
+	{
+		EndChunks(build.spareThreads, numChunks);
+		makeLeaf();
+		return;
+	}
+
+	const int binCount = std::max(params.binCount, 2);
+	const float leafCost = params.leafCost * count;
+	const float invArea = 1.0f / std::max(SurfaceArea(nodeBound), 1e-20f);
+
+	// Object split, binned by reference centers the same way as Subdivide
+	std::vector<ObjectBin> bins(3 * binCount * numChunks);
+	std::vector<Box> rightBound(binCount);
+	std::vector<unsigned int> rightCount(binCount);
+	float binScale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = centerBound.pmax[axis] - centerBound.pmin[axis];
+		binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+	}
+	ForEachChunk(numChunks, 0, count, [&](int c, unsigned int begin, unsigned int end)
+	{
+		ObjectBin* chunkBins = &bins[3 * binCount * c];
+		for (unsigned int i = begin; i < end; i++)
+		{
+			Reference const& r = refs[i];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int b = std::min((int)(((r.bound.pmin[axis] + r.bound.pmax[axis]) * 0.5f - centerBound.pmin[axis]) * binScale[axis]), binCount - 1);
+				chunkBins[axis * binCount + b].count++;
+				chunkBins[axis * binCount + b].bound += r.bound;
+			}
+		}
+	});
+	for (int c = 1; c < numChunks; c++)
+	{
+		for (int b = 0; b < 3 * binCount; b++)
+		{
+			bins[b].count += bins[3 * binCount * c + b].count;
+			bins[b].bound += bins[3 * binCount * c + b].bound;
+		}
+	}
+
+	float objectCost = BIGFLOAT;
+	int objectAxis = -1, objectSplit = 0;
+	Box objectLeft, objectRight;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (binScale[axis] == 0.0f) continue;
+		ObjectBin const* axisBins = &bins[axis * binCount];
+
+		Box right;
+		unsigned int numRight = 0;
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			right += axisBins[b].bound;
+			numRight += axisBins[b].count;
+			rightBound[b] = right;
+			rightCount[b] = numRight;
+		}
+
+		Box left;
+		unsigned int numLeft = 0;
+		for (int b = 1; b < binCount; b++)
+		{
+			left += axisBins[b - 1].bound;
+			numLeft += axisBins[b - 1].count;
+			if (numLeft == 0 || rightCount[b] == 0) continue;
+
+			float cost = params.traversalCost + params.leafCost * (SurfaceArea(left) * numLeft + SurfaceArea(rightBound[b]) * rightCount[b]) * invArea;
+			if (cost < objectCost)
+			{
+				objectCost = cost;
+				objectAxis = axis;
+				objectSplit = b;
+				objectLeft = left;
+				objectRight = rightBound[b];
+			}
+		}
+	}
+
+	// Spatial split, binned by position within the node, only where the object split children overlap
+	float spatialCost = BIGFLOAT;
+	int spatialAxis = -1;
+	float spatialPlane = 0.0f;
+
+	if (duplicateBudget > 0 && (objectAxis < 0 || SurfaceArea(Overlap(objectLeft, objectRight)) > build.minOverlap))
+	{
+		struct SpatialBin
+		{
+			Box bound;
+			unsigned int enter = 0;
+			unsigned int exit = 0;
+		};
+		std::vector<SpatialBin> sbins(3 * binCount * numChunks);
+		float binWidth[3];
+		for (int axis = 0; axis < 3; axis++) binWidth[axis] = (nodeBound.pmax[axis] - nodeBound.pmin[axis]) / binCount;
+
+		ForEachChunk(numChunks, 0, count, [&](int c, unsigned int begin, unsigned int end)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (binWidth[axis] <= 0.0f) continue;
+				SpatialBin* axisBins = &sbins[(3 * c + axis) * binCount];
+				const float lo = nodeBound.pmin[axis];
+				for (unsigned int i = begin; i < end; i++)
+				{
+					Reference const& r = refs[i];
+					int b0 = std::min(std::max((int)((r.bound.pmin[axis] - lo) / binWidth[axis]), 0), binCount - 1);
+					int b1 = std::min(std::max((int)((r.bound.pmax[axis] - lo) / binWidth[axis]), b0), binCount - 1);
+					Vec3f const* v = &build.verts[3 * r.element];
+					for (int b = b0; b <= b1; b++)
+					{
+						if (b0 == b1) axisBins[b].bound += r.bound;
+						else
+						{
+							float planeLo = (b == b0) ? -BIGFLOAT : lo + b * binWidth[axis];
+							float planeHi = (b == b1) ? BIGFLOAT : lo + (b + 1) * binWidth[axis];
+							axisBins[b].bound += ClipTriangle(v, axis, planeLo, planeHi, r.bound);
+						}
+					}
+					axisBins[b0].enter++;
+					axisBins[b1].exit++;
+				}
+			}
+		});
+		for (int c = 1; c < numChunks; c++)
+		{
+			for (int b = 0; b < 3 * binCount; b++)
+			{
+				SpatialBin const& cb = sbins[3 * binCount * c + b];
+				sbins[b].bound += cb.bound;
+				sbins[b].enter += cb.enter;
+				sbins[b].exit += cb.exit;
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (binWidth[axis] <= 0.0f) continue;
+			SpatialBin const* axisBins = &sbins[axis * binCount];
+
+			Box right;
+			unsigned int numRight = 0;
+			for (int b = binCount - 1; b > 0; b--)
+			{
+				right += axisBins[b].bound;
+				numRight += axisBins[b].exit;
+				rightBound[b] = right;
+				rightCount[b] = numRight;
+			}
+
+			Box left;
+			unsigned int numLeft = 0;
+			for (int b = 1; b < binCount; b++)
+			{
+				left += axisBins[b - 1].bound;
+				numLeft += axisBins[b - 1].enter;
+				if (numLeft == 0 || rightCount[b] == 0) continue;
+
+				float cost = params.traversalCost + params.leafCost * (SurfaceArea(left) * numLeft + SurfaceArea(rightBound[b]) * rightCount[b]) * invArea;
+				if (cost < spatialCost)
+				{
+					spatialCost = cost;
+					spatialAxis = axis;
+					spatialPlane = nodeBound.pmin[axis] + b * binWidth[axis];
+				}
+			}
+		}
+	}
+
+	EndChunks(build.spareThreads, numChunks);
+
+	const float bestCost = std::min(objectCost, spatialCost);
+	const bool mustSplit = count > params.maxLeafSize;
+	if (!mustSplit && !(bestCost < leafCost)) { makeLeaf(); return; }
+
+	std::vector<Reference> leftRefs, rightRefs;
+	int axis = 0;
+	int budgetLeft = duplicateBudget;
+
+	if (spatialAxis >= 0 && spatialCost < objectCost && depth + 16 < BVH_MAX_DEPTH)
+	{
+		axis = spatialAxis;
+		for (Reference const& r : refs)
+		{
+			if (r.bound.pmax[axis] <= spatialPlane) leftRefs.push_back(r);
+			else if (r.bound.pmin[axis] >= spatialPlane) rightRefs.push_back(r);
+			else if (budgetLeft > 0)
+			{
+				Vec3f const* v = &build.verts[3 * r.element];
+				Reference lr = { ClipTriangle(v, axis, -BIGFLOAT, spatialPlane, r.bound), r.element };
+				Reference rr = { ClipTriangle(v, axis, spatialPlane, BIGFLOAT, r.bound), r.element };
+				if (!lr.bound.IsEmpty()) leftRefs.push_back(lr);
+				if (!rr.bound.IsEmpty()) rightRefs.push_back(rr);
+				if (!lr.bound.IsEmpty() && !rr.bound.IsEmpty()) budgetLeft--;
+			}
+			else
+			{
+				// Out of budget, keep the reference whole on the side of its center
+				if ((r.bound.pmin[axis] + r.bound.pmax[axis]) * 0.5f < spatialPlane) leftRefs.push_back(r);
+				else rightRefs.push_back(r);
+			}
+		}
+	}
+
+	if (leftRefs.empty() || rightRefs.empty())
+	{
+		leftRefs.clear();
+		rightRefs.clear();
+		budgetLeft = duplicateBudget;
+		if (objectAxis >= 0 && depth + 16 < BVH_MAX_DEPTH)
+		{
+			axis = objectAxis;
+			const float cmin = centerBound.pmin[axis];
+			for (Reference const& r : refs)
+			{
+				int b = std::min((int)(((r.bound.pmin[axis] + r.bound.pmax[axis]) * 0.5f - cmin) * binScale[axis]), binCount - 1);
+				(b < objectSplit ? leftRefs : rightRefs).push_back(r);
+			}
+		}
+		else if (mustSplit)
+		{
+			// Coincident centers or close to the depth limit, split at the median
+			if (objectAxis >= 0) axis = objectAxis;
+			std::nth_element(refs.begin(), refs.begin() + count / 2, refs.end(),
+				[axis](Reference const& a, Reference const& b) { return a.bound.pmin[axis] + a.bound.pmax[axis] < b.bound.pmin[axis] + b.bound.pmax[axis]; });
+			leftRefs.assign(refs.begin(), refs.begin() + count / 2);
+			rightRefs.assign(refs.begin() + count / 2, refs.end());
+		}
+		else { makeLeaf(); return; }
+	}
+
+	// The parent references are no longer needed, release them before going deeper
+	std::vector<Reference>().swap(refs);
+
+	// Share what is left of the budget by the size of the children
+	const unsigned int numLeft = (unsigned int)leftRefs.size(), numRight = (unsigned int)rightRefs.size();
+	const int leftBudget = (int)((long long)budgetLeft * numLeft / (numLeft + numRight));
+	const int rightBudget = budgetLeft - leftBudget;
+
+	const unsigned int child = build.numBuildNodes.fetch_add(2);
+	node.first = child;
+	node.count = 0;
+	node.axis = axis;
+
+	BuildSubtrees(build.spareThreads, numLeft,
+		[&, child, depth, leftBudget]() { SubdivideSpatial(build, child, leftRefs, depth + 1, leftBudget); },
+		[&, child, depth, rightBudget]() { SubdivideSpatial(build, child + 1, rightRefs, depth + 1, rightBudget); });
+}
+
+/**
+ * Writes the subtree into the linear node array in depth-first order and returns the
+ * index of its root. The first child directly follows its parent, so only the second
+ * child index is stored. When leafElements is given, the leaves index into it and their
+ * elements are copied out in the same depth-first order.
+ */
+unsigned int SAHBVH::Flatten(std::vector<BuildNode> const& buildNodes, unsigned int buildNodeID, unsigned int const* leafElements)
+{
+	BuildNode const& b = buildNodes[buildNodeID];
+	const unsigned int nodeID = (unsigned int)nodes.size();
+	nodes.push_back(LinearBVHNode());
+	SetNodeBounds(nodes[nodeID].bounds, b.bound);
+	nodes[nodeID].axis = (unsigned char)b.axis;
+	nodes[nodeID].pad = 0;
+
+	if (b.count > 0)
+	{
+		if (leafElements)
+		{
+			nodes[nodeID].offset = (unsigned int)elements.size();
+			elements.insert(elements.end(), leafElements + b.first, leafElements + b.first + b.count);
+		}
+		else nodes[nodeID].offset = b.first;
+		// A larger leaf would lose elements to the 16-bit count, the median splits near the depth limit rule it out
+		assert(b.count <= BVH_MAX_LEAF_COUNT);
+		nodes[nodeID].count = (unsigned short)b.count;
+	}
+	else
+	{
+		Flatten(buildNodes, b.first, leafElements);
+		unsigned int second = Flatten(buildNodes, b.first + 1, leafElements);
+		nodes[nodeID].offset = second;
+		nodes[nodeID].count = 0;
+	}
+	return nodeID;
+}
+
+/**
+ * Sums the expected cost of a random ray hitting the root: traversal cost for interior
+ * nodes and per-element cost for leaves, weighted by surface area relative to the root.
+ */
+void SAHBVH::ComputeSAHCost()
+{
+	sahCost = 0.0f;
+	float rootArea = SurfaceArea(Box(nodeData[0].bounds));
+	if (rootArea <= 0.0f) return;
+
+	for (unsigned int i = 0; i < numNodes; i++)
+	{
+		LinearBVHNode const& n = nodeData[i];
+		float area = SurfaceArea(Box(n.bounds));
+		sahCost += (n.count > 0 ? buildParams.leafCost * n.count : buildParams.traversalCost) * area;
+	}
+	sahCost /= rootArea;
+}
+
+/**
+ * Refits the hierarchy to new element bounds in a single reverse sweep. Children always come
+ * after their parent in the depth-first layout, so they are updated before the parent reads them.
+ * The split quality is not revisited; callers compare the returned cost to decide on a rebuild.
+ *
+ * @param elementBounds  Bounding box of every element, indexed by element ID as in Build.
+ */
+float SAHBVH::Refit(std::vector<Box> const& elementBounds)
+{
+	for (int i = (int)numNodes - 1; i >= 0; i--)
+	{
+		LinearBVHNode& node = nodeData[i];
+		Box b;
+		if (node.count > 0)
+		{
+			for (unsigned int k = 0; k < node.count; k++) b += elementBounds[elementData[node.offset + k]];
+		}
+		else
+		{
+			b += Box(nodeData[i + 1].bounds);
+			b += Box(nodeData[node.offset].bounds);
+		}
+		SetNodeBounds(node.bounds, b);
+	}
+	ComputeSAHCost();
+	return sahCost;
+}
+
+//-------------------------------------------------------------------------------
+
+#ifdef BVH_NODE_CACHE_STATS
+
+struct NodeCacheThread
+{
+	uintptr_t      tags[NodeCacheStats::numLines] = {};
+	NodeCacheStats counts;
+};
+static thread_local NodeCacheThread nodeCacheThread;
+static std::mutex     nodeCacheMutex;
+static NodeCacheStats nodeCacheTotals;
+
+void NodeCacheStats::Touch(void const* node, size_t size)
+{
+	uintptr_t first = (uintptr_t)node >> lineBits;
+	uintptr_t last = ((uintptr_t)node + size - 1) >> lineBits;
+	for (uintptr_t line = first; line <= last; line++)
+	{
+		uintptr_t& tag = nodeCacheThread.tags[line & (numLines - 1)];
+		nodeCacheThread.counts.fetches++;
+		if (tag != line)
+		{
+			nodeCacheThread.counts.misses++;
+			tag = line;
+		}
+	}
+}
+
+void NodeCacheStats::Flush()
+{
+	std::lock_guard<std::mutex> lock(nodeCacheMutex);
+	nodeCacheTotals.fetches += nodeCacheThread.counts.fetches;
+	nodeCacheTotals.misses += nodeCacheThread.counts.misses;
+	nodeCacheThread.counts = NodeCacheStats();
+}
+
+NodeCacheStats NodeCacheStats::Take()
+{
+	std::lock_guard<std::mutex> lock(nodeCacheMutex);
+	NodeCacheStats totals = nodeCacheTotals;
+	nodeCacheTotals = NodeCacheStats();
+	return totals;
+}
+
+#endif
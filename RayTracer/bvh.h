@@ -0,0 +1,251 @@
+#pragma once
+///
+/// \file       bvh.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Bounding volume hierarchy built with binned surface area heuristic splits
+///
+
+#include <vector>
+#include <memory>
+#include <climits>
+#include <cstdint>
+#include <utility>
+#include "scene.h"
+
+// Deepest level the builder creates, so traversal can use fixed size stacks
+#define BVH_MAX_DEPTH 64
+
+// Most elements a leaf can hold, LinearBVHNode keeps the count in 16 bits. The builders split at the
+// median over the last 16 levels above BVH_MAX_DEPTH, which brings any 32-bit element count under it.
+#define BVH_MAX_LEAF_COUNT USHRT_MAX
+
+struct BVHBuildParams
+{
+	int          binCount = 16;			// bins per axis used to evaluate split candidates
+	float        traversalCost = 1.0f;	// cost of visiting an interior node
+	float        leafCost = 1.0f;		// cost of intersecting one element in a leaf
+	unsigned int maxLeafSize = 8;		// nodes with more elements than this are always split
+	int          width = 2;				// branching factor of the traversal layout: 2, 4 (SSE) or 8 (AVX)
+	bool         quantized = false;		// with width 8, store child boxes as 8-bit offsets (CompressedBVH) and free the full-float nodes
+	bool         spatialSplits = false;	// split triangle references across planes where it lowers the cost (SBVH), used by BuildSpatial
+	float        spatialAlpha = 1e-5f;	// spatial splits are only tried where the object split children overlap by more than this fraction of the root area
+	float        duplicateBudget = 0.3f;	// extra references spatial splits may create, as a fraction of the triangle count
+	int          numThreads = 0;			// threads a build may use, 0 for one per core; the result does not depend on it
+};
+
+// One node of the flattened hierarchy, sized so two nodes share a 64-byte cache line.
+// Nodes are stored in depth-first order, so the first child of an interior node is always the next node.
+struct alignas(32) LinearBVHNode
+{
+	float          bounds[6];	// min x,y,z followed by max x,y,z
+	unsigned int   offset;		// first element for leaves, index of the second child for interior nodes
+	unsigned short count;		// number of elements, zero for interior nodes
+	unsigned char  axis;		// split axis of interior nodes
+	unsigned char  pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must stay 32 bytes");
+
+// Define BVH_NODE_CACHE_STATS to count the node fetches of traversal against a simulated cache per thread.
+// The counts compare how well different ray orders reuse nodes; they are not hardware counters.
+#ifdef BVH_NODE_CACHE_STATS
+struct NodeCacheStats
+{
+	static const unsigned int lineBits = 6;		// 64-byte lines
+	static const unsigned int numLines = 4096;	// direct mapped, 256 KB
+
+	uint64_t fetches = 0;	// cache lines read
+	uint64_t misses = 0;
+
+	static void Touch(void const* node, size_t size);
+	static void Flush();				// adds the counts of the calling thread to the totals
+	static NodeCacheStats Take();		// returns the totals and resets them
+};
+#define BVH_TOUCH_NODE(node) NodeCacheStats::Touch(node, sizeof(*(node)))
+#else
+#define BVH_TOUCH_NODE(node)
+#endif
+
+class MappedFile;
+
+class SAHBVH
+{
+public:
+	// Traversal points into the owned storage, so a copy would point into the original
+	SAHBVH() {}
+	SAHBVH(SAHBVH const&) = delete;
+	SAHBVH& operator = (SAHBVH const&) = delete;
+
+	// Builds the hierarchy over the given element bounding boxes
+	void Build(std::vector<Box> const& elementBounds, BVHBuildParams const& params = BVHBuildParams());
+
+	// Builds the hierarchy over triangles given as three consecutive vertices each. A triangle may be
+	// referenced from more than one leaf when a spatial split is cheaper than any object split.
+	void BuildSpatial(std::vector<Vec3f> const& triangleVerts, BVHBuildParams const& params = BVHBuildParams());
+	void Clear();
+
+	// Uses node and element arrays that live in a memory-mapped cache file instead of building.
+	// The mapping is kept alive as long as the hierarchy uses it.
+	void Attach(std::shared_ptr<MappedFile> const& file, LinearBVHNode* nodeArray, unsigned int nodeCount,
+	            unsigned int* elementArray, unsigned int elementCount, float cost, BVHBuildParams const& params);
+
+	// Frees the nodes once a derived layout has taken over traversal. The elements, node count and cost stay,
+	// but node access, FindAny and Refit must not be used afterwards.
+	void ReleaseNodes();
+
+	// Recomputes the node bounds bottom-up after the elements moved, keeping the topology, and returns the new SAH cost
+	float Refit(std::vector<Box> const& elementBounds);
+
+	// Direct node access for traversal, a node visit touches a single record
+	LinearBVHNode const& GetNode(unsigned int nodeID) const { BVH_TOUCH_NODE(nodeData + nodeID); return nodeData[nodeID]; }
+	unsigned int const*  GetElements(unsigned int first) const { return elementData + first; }
+
+	// Node access, kept in line with cyBVH so traversal code can use either
+	bool                IsEmpty() const { return numNodes == 0; }
+	unsigned int        GetRootNodeID() const { return 0; }
+	unsigned int        GetNumNodes() const { return numNodes; }
+	unsigned int        GetNumElements() const { return numElements; }	// includes references duplicated by spatial splits
+	size_t              GetNodeMemoryUsage() const { return nodeData ? (size_t)numNodes * sizeof(LinearBVHNode) : 0; }
+	float const*        GetNodeBounds(unsigned int nodeID) const { return nodeData[nodeID].bounds; }
+	bool                IsLeafNode(unsigned int nodeID) const { return nodeData[nodeID].count > 0; }
+	unsigned int        GetNodeElementCount(unsigned int nodeID) const { return nodeData[nodeID].count; }
+	unsigned int const* GetNodeElements(unsigned int nodeID) const { return elementData + nodeData[nodeID].offset; }
+	void                GetChildNodes(unsigned int nodeID, unsigned int& child1, unsigned int& child2) const { child1 = nodeID + 1; child2 = nodeData[nodeID].offset; }
+
+	// Any-hit traversal of the subtree under startNode. Children are visited in the order the ray crosses the split axis,
+	// without comparing box distances. leafShadow(first, count) returns the slot of
+	// an element in [first, first+count) that blocks the ray, or -1. Returns the first blocking slot found, or -1, and
+	// sets parent to the interior node above the leaf that held it (startNode if that is the leaf).
+	template <typename LeafShadow>
+	int FindAny(Ray const& ray, float t_max, unsigned int startNode, unsigned int& parent, LeafShadow const& leafShadow) const;
+
+	// Returns the SAH cost of the tree, normalized by the surface area of the root
+	float GetSAHCost() const { return sahCost; }
+
+	// Parameters the hierarchy was built with
+	BVHBuildParams const& GetBuildParams() const { return buildParams; }
+
+private:
+	// Node layout used while building, children of a node are stored next to each other
+	struct BuildNode
+	{
+		Box          bound;
+		unsigned int first = 0;	// first element for leaves, first of the two children otherwise
+		unsigned int count = 0;	// number of elements, zero for interior nodes
+		int          axis = 0;
+	};
+
+	// An element reference during a spatial split build, its box may be clipped to part of the element
+	struct Reference
+	{
+		Box          bound;
+		unsigned int element;
+	};
+	struct ObjectBuild;
+	struct SpatialBuild;
+
+	// Storage filled by the builders
+	std::vector<LinearBVHNode> nodes;
+	std::vector<unsigned int>  elements;
+
+	// Storage used by traversal, either the vectors above or a memory-mapped cache file
+	std::shared_ptr<MappedFile> mapping;
+	LinearBVHNode*              nodeData = nullptr;
+	unsigned int                numNodes = 0;
+	unsigned int*               elementData = nullptr;
+	unsigned int                numElements = 0;
+
+	float                      sahCost = 0.0f;
+	BVHBuildParams             buildParams;	// parameters of the last build, used for the cost after a refit
+
+	void         UseOwnedStorage();
+	void         Subdivide(ObjectBuild& build, unsigned int nodeID, unsigned int depth);
+	void         SubdivideSpatial(SpatialBuild& build, unsigned int nodeID, std::vector<Reference>& refs, unsigned int depth, int duplicateBudget);
+	unsigned int Flatten(std::vector<BuildNode> const& buildNodes, unsigned int buildNodeID, unsigned int const* leafElements);
+	void         ComputeSAHCost();
+};
+
+#define FAST_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define FAST_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Ray-AABB intersection against bounds stored as min x,y,z followed by max x,y,z.
+// Writes the entry distance to tNear and returns true if the ray enters the box before t_max.
+// The sign bits of the ray pick the near and far plane of each slab, so every plane distance
+// is one multiply-subtract and only the three slabs are combined with min/max.
+inline bool hitAABB(Ray const& ray, const float* bounds, float t_max, float& tNear)
+{
+	float tminX = bounds[3 * ray.sign[0]] * ray.invDir.x - ray.pInvDir.x;
+	float tmaxX = bounds[3 - 3 * ray.sign[0]] * ray.invDir.x - ray.pInvDir.x;
+	float tminY = bounds[1 + 3 * ray.sign[1]] * ray.invDir.y - ray.pInvDir.y;
+	float tmaxY = bounds[4 - 3 * ray.sign[1]] * ray.invDir.y - ray.pInvDir.y;
+	float tminZ = bounds[2 + 3 * ray.sign[2]] * ray.invDir.z - ray.pInvDir.z;
+	float tmaxZ = bounds[5 - 3 * ray.sign[2]] * ray.invDir.z - ray.pInvDir.z;
+
+	float tmin = FAST_MAX(FAST_MAX(tminX, tminY), tminZ);
+	float tmax = FAST_MIN(FAST_MIN(tmaxX, tmaxY), tmaxZ);
+
+	tNear = tmin;
+	return tmax >= tmin && tmax >= 0.0f && tmin <= t_max;
+}
+
+// Returns the surface area of the box, zero for empty boxes
+inline float SurfaceArea(Box const& b)
+{
+	if (b.IsEmpty()) return 0.0f;
+	Vec3f d = b.pmax - b.pmin;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+template <typename LeafShadow>
+int SAHBVH::FindAny(Ray const& ray, float t_max, unsigned int startNode, unsigned int& parent, LeafShadow const& leafShadow) const
+{
+	struct StackEntry { unsigned int node, parent; };
+	StackEntry stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	unsigned int nodeID = startNode;
+	unsigned int parentID = startNode;
+	float tNear;
+	if (!hitAABB(ray, GetNode(nodeID).bounds, t_max, tNear)) return -1;
+
+	for (;;)
+	{
+		LinearBVHNode const& node = GetNode(nodeID);
+		if (node.count > 0)
+		{
+			int slot = leafShadow(node.offset, (unsigned int)node.count);
+			if (slot >= 0)
+			{
+				parent = parentID;
+				return slot;
+			}
+		}
+		else
+		{
+			unsigned int child1 = nodeID + 1;
+			unsigned int child2 = node.offset;
+			if (ray.dir[node.axis] < 0.0f) std::swap(child1, child2);
+			float t1, t2;
+			bool hit1 = hitAABB(ray, GetNode(child1).bounds, t_max, t1);
+			bool hit2 = hitAABB(ray, GetNode(child2).bounds, t_max, t2);
+
+			if (hit1 && hit2)
+			{
+				stack[stackSize++] = { child2, nodeID };
+				parentID = nodeID;
+				nodeID = child1;
+				continue;
+			}
+			if (hit1) { parentID = nodeID; nodeID = child1; continue; }
+			if (hit2) { parentID = nodeID; nodeID = child2; continue; }
+		}
+
+		if (stackSize == 0) break;
+		StackEntry entry = stack[--stackSize];
+		nodeID = entry.node;
+		parentID = entry.parent;
+	}
+
+	return -1;
+}
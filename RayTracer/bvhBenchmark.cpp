@@ -0,0 +1,155 @@
+///
+/// \file       bvhBenchmark.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Layout benchmark defined in bvhBenchmark.h
+///
+
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include "bvhBenchmark.h"
+#include "objects.h"
+#include "sceneBVH.h"
+#include "rng.h"
+
+// Rays start on a sphere twice the size of the mesh bounds and aim at a random point inside them
+static std::vector<Ray> GenerateRays(Box const& bounds, int numRays)
+{
+	RNG rng(0);
+	Vec3f center = (bounds.pmin + bounds.pmax) * 0.5f;
+	float radius = (bounds.pmax - bounds.pmin).Length();
+	std::vector<Ray> rays(numRays);
+	for (Ray& ray : rays)
+	{
+		float z = 2.0f * rng.RandomFloat() - 1.0f;
+		float phi = 2.0f * Pi<float>() * rng.RandomFloat();
+		float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+		Vec3f origin = center + Vec3f(r * cosf(phi), r * sinf(phi), z) * radius;
+		Vec3f target(bounds.pmin.x + (bounds.pmax.x - bounds.pmin.x) * rng.RandomFloat(),
+		             bounds.pmin.y + (bounds.pmax.y - bounds.pmin.y) * rng.RandomFloat(),
+		             bounds.pmin.z + (bounds.pmax.z - bounds.pmin.z) * rng.RandomFloat());
+		ray = Ray(origin, (target - origin).GetNormalized());
+	}
+	return rays;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BenchmarkBVHLayouts(ObjFileList& objList, int numRays)
+{
+	struct Layout
+	{
+		char const* name;
+		int         width;
+		bool        quantized;
+	};
+	const Layout layouts[] = { { "binary", 2, false }, { "8-wide", 8, false }, { "8-wide quantized", 8, true } };
+
+	for (Object* obj : objList)
+	{
+		TriObj* mesh = dynamic_cast<TriObj*>(obj);
+		if (!mesh || mesh->NF() == 0) continue;
+
+		mesh->EnsureBVH();
+		BVHBuildParams original = mesh->GetBVHParams();
+		original.width = mesh->GetBVHWidth();
+		original.quantized = mesh->IsBVHQuantized();
+		TriangleLayout triLayout = mesh->GetTriangleLayout();
+
+		std::vector<Ray> rays = GenerateRays(mesh->GetBoundBox(), numRays);
+		printf("BVH layouts of \"%s\": %u faces, %d rays\n", mesh->GetName(), mesh->NF(), numRays);
+
+		size_t binaryMemory = 0;
+		for (Layout const& layout : layouts)
+		{
+			BVHBuildParams params = original;
+			params.width = layout.width;
+			params.quantized = layout.quantized;
+			mesh->BuildAccelerationStructure(params, triLayout);
+			// All nodes the mesh keeps, the full-float 8-wide layout keeps the binary nodes as well
+			size_t memory = mesh->GetBVHNodeMemory();
+			if (layout.width == 2) binaryMemory = memory;
+
+			int hits = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (Ray const& ray : rays)
+			{
+				HitInfo hInfo;
+				if (mesh->IntersectRay(ray, hInfo, HIT_FRONT_AND_BACK)) hits++;
+			}
+			double closestTime = Seconds(start);
+
+			int blocked = 0;
+			start = std::chrono::steady_clock::now();
+			for (Ray const& ray : rays)
+			{
+				if (mesh->ShadowRay(ray, BIGFLOAT)) blocked++;
+			}
+			double anyTime = Seconds(start);
+
+			printf("  %-17s %8.2f MB (%4.2fx binary)  closest %6.2f Mrays/s (%d hits)  any %6.2f Mrays/s (%d blocked)\n",
+				layout.name, memory / (1024.0 * 1024.0), binaryMemory ? (double)memory / binaryMemory : 0.0,
+				numRays / closestTime * 1e-6, hits, numRays / anyTime * 1e-6, blocked);
+		}
+
+		mesh->BuildAccelerationStructure(original, triLayout);
+	}
+}
+
+// Every node that holds an object, in depth-first order
+static void CollectObjectNodes(Node& node, std::vector<Node*>& list)
+{
+	if (node.GetNodeObj()) list.push_back(&node);
+	for (int i = 0; i < node.GetNumChild(); i++) CollectObjectNodes(*node.GetChild(i), list);
+}
+
+bool CheckSceneRefit(Node& root, int numRays)
+{
+	std::vector<Node*> objectNodes;
+	CollectObjectNodes(root, objectNodes);
+	Box sceneBounds = root.ComputeChildBoundBox();
+	if (objectNodes.empty() || sceneBounds.IsEmpty()) return true;
+
+	SceneBVH refit;
+	refit.Build(root);
+
+	// Small rigid motions, so the refit tree stays under the rebuild threshold
+	std::vector<Transformation> original;
+	original.reserve(objectNodes.size());
+	RNG rng(1);
+	const float step = 0.02f * (sceneBounds.pmax - sceneBounds.pmin).Length();
+	for (Node* node : objectNodes)
+	{
+		original.push_back(*node);
+		Vec3f offset(rng.RandomFloat() - 0.5f, rng.RandomFloat() - 0.5f, rng.RandomFloat() - 0.5f);
+		node->Rotate(Vec3f(0, 1, 0), 10.0f * (rng.RandomFloat() - 0.5f));
+		node->Translate(offset * step);
+	}
+	sceneBounds = root.ComputeChildBoundBox();
+
+	const bool wasRefit = refit.Refit(root);
+	SceneBVH rebuilt;
+	rebuilt.Build(root);
+
+	int mismatches = 0;
+	for (Ray const& ray : GenerateRays(sceneBounds, numRays))
+	{
+		HitInfo a, b;
+		bool hitA = refit.IntersectRay(ray, a, HIT_FRONT_AND_BACK);
+		bool hitB = rebuilt.IntersectRay(ray, b, HIT_FRONT_AND_BACK);
+		// Different nodes at the same distance are coincident surfaces, either one is a valid answer
+		if (hitA != hitB || (hitA && fabsf(a.z - b.z) > 1e-4f * std::max(1.0f, b.z))) mismatches++;
+	}
+
+	for (size_t i = 0; i < objectNodes.size(); i++) static_cast<Transformation&>(*objectNodes[i]) = original[i];
+	root.ComputeChildBoundBox();
+
+	printf("Scene refit check: %zu object nodes moved, %s, %d rays, %d mismatches\n", objectNodes.size(),
+		wasRefit ? "refit" : "rebuilt past the cost threshold", numRays, mismatches);
+	return mismatches == 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+///
+/// \file       bvhBenchmark.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Compares the memory and traversal speed of the mesh BVH layouts
+///
+/// Rebuilds every mesh of the scene with the binary, 8-wide and quantized 8-wide layouts in
+/// turn and traces the same random rays through each one, closest hit and any hit, on a
+/// single thread. Each mesh is rebuilt with its own layout afterwards. Run with -bvhbench.
+///
+/// CheckSceneRefit moves every object node of the scene a little, refits a scene hierarchy
+/// to the new transformations and checks that it finds the same closest hits as a hierarchy
+/// built from scratch. The nodes are put back afterwards. Run with -refitcheck.
+///
+
+#include "scene.h"
+
+void BenchmarkBVHLayouts(ObjFileList& objList, int numRays = 1 << 20);
+
+// Returns true if every ray hit the same surface at the same distance in both hierarchies
+bool CheckSceneRefit(Node& root, int numRays = 1 << 16);
@@ -0,0 +1,251 @@
+///
+/// \file       bvhCache.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the hierarchy cache defined in bvhCache.h
+///
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <vector>
+#include "bvhCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Bump whenever the node layout or the builders change, so old cache files are ignored
+#define BVH_CACHE_VERSION 2
+
+struct BVHCacheHeader
+{
+	char         magic[4];	// "BVHC"
+	unsigned int version;
+	uint64_t     key;
+	unsigned int numNodes;
+	unsigned int numElements;
+	float        sahCost;
+	unsigned int pad;
+};
+static_assert(sizeof(BVHCacheHeader) == sizeof(LinearBVHNode), "The header keeps the node array 32-byte aligned");
+
+static std::string cacheDirectory = "bvhcache";
+
+//-------------------------------------------------------------------------------
+
+bool MappedFile::Open(char const* filename)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { CloseHandle(file); return false; }
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!mapping) { CloseHandle(file); return false; }
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!view) { CloseHandle(mapping); CloseHandle(file); return false; }
+	fileHandle = file;
+	mappingHandle = mapping;
+	data = (char*)view;
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) return false;
+	data = (char*)view;
+	size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mappingHandle);
+	CloseHandle((HANDLE)fileHandle);
+	mappingHandle = fileHandle = nullptr;
+#else
+	munmap(data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+//-------------------------------------------------------------------------------
+
+// 64-bit FNV-1a
+static void HashBytes(uint64_t& h, void const* bytes, size_t n)
+{
+	unsigned char const* p = (unsigned char const*)bytes;
+	for (size_t i = 0; i < n; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+}
+
+template <typename T> static void HashValue(uint64_t& h, T const& v) { HashBytes(h, &v, sizeof(T)); }
+
+void SetBVHCacheDirectory(char const* dir)
+{
+	cacheDirectory = dir ? dir : "";
+}
+
+/**
+ * Hashes the mesh file contents together with every parameter that changes the binary
+ * hierarchy. The traversal width is left out, wide layouts are collapsed after loading.
+ */
+uint64_t ComputeBVHCacheKey(char const* filename, BVHBuildParams const& params)
+{
+	if (cacheDirectory.empty()) return 0;
+
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) return 0;
+
+	uint64_t h = 14695981039346656037ull;
+	char buffer[1 << 16];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) HashBytes(h, buffer, n);
+	fclose(fp);
+
+	HashValue(h, (int)BVH_CACHE_VERSION);
+	HashValue(h, (int)BVH_MAX_DEPTH);
+	HashValue(h, params.binCount);
+	HashValue(h, params.traversalCost);
+	HashValue(h, params.leafCost);
+	HashValue(h, params.maxLeafSize);
+	HashValue(h, params.spatialSplits);
+	if (params.spatialSplits)
+	{
+		HashValue(h, params.spatialAlpha);
+		HashValue(h, params.duplicateBudget);
+	}
+	return h ? h : 1;
+}
+
+static std::string CacheFileName(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+	return cacheDirectory + "/" + name;
+}
+
+/**
+ * Checks that traversal cannot leave the arrays of a cache file: every interior node points
+ * forward to a second child inside the node array, every leaf range lies inside the element
+ * array, and no node is deeper than the fixed traversal stacks allow.
+ */
+static bool ValidateNodes(LinearBVHNode const* nodeArray, unsigned int numNodes, unsigned int numElements)
+{
+	std::vector<unsigned char> depth(numNodes, 0);
+	for (unsigned int i = 0; i < numNodes; i++)
+	{
+		LinearBVHNode const& node = nodeArray[i];
+		if (node.count > 0)
+		{
+			if ((uint64_t)node.offset + node.count > numElements) return false;
+			continue;
+		}
+		// The first child directly follows, the second one comes after it
+		if (node.offset <= i + 1 || node.offset >= numNodes || node.axis > 2) return false;
+		if (depth[i] + 1 >= BVH_MAX_DEPTH) return false;
+		depth[i + 1] = std::max(depth[i + 1], (unsigned char)(depth[i] + 1));
+		depth[node.offset] = std::max(depth[node.offset], (unsigned char)(depth[i] + 1));
+	}
+	return true;
+}
+
+bool LoadBVHCache(uint64_t key, unsigned int elementLimit, BVHBuildParams const& params, SAHBVH& bvh)
+{
+	if (key == 0 || cacheDirectory.empty()) return false;
+
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->Open(CacheFileName(key).c_str())) return false;
+	if (file->Size() < sizeof(BVHCacheHeader)) return false;
+
+	BVHCacheHeader const* header = (BVHCacheHeader const*)file->Data();
+	if (memcmp(header->magic, "BVHC", 4) != 0 || header->version != BVH_CACHE_VERSION || header->key != key) return false;
+	if (header->numNodes == 0) return false;
+
+	size_t expected = sizeof(BVHCacheHeader) + (size_t)header->numNodes * sizeof(LinearBVHNode) + (size_t)header->numElements * sizeof(unsigned int);
+	if (file->Size() != expected) return false;
+
+	LinearBVHNode* nodeArray = (LinearBVHNode*)(file->Data() + sizeof(BVHCacheHeader));
+	unsigned int* elementArray = (unsigned int*)(nodeArray + header->numNodes);
+
+	// Guard against a cache that does not belong to this mesh after all
+	for (unsigned int i = 0; i < header->numElements; i++)
+		if (elementArray[i] >= elementLimit) return false;
+	if (!ValidateNodes(nodeArray, header->numNodes, header->numElements)) return false;
+
+	bvh.Attach(file, nodeArray, header->numNodes, elementArray, header->numElements, header->sahCost, params);
+	return true;
+}
+
+bool SaveBVHCache(uint64_t key, SAHBVH const& bvh)
+{
+	if (key == 0 || cacheDirectory.empty() || bvh.IsEmpty()) return false;
+
+#ifdef _WIN32
+	_mkdir(cacheDirectory.c_str());
+#else
+	mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+	// Written under a name of its own and renamed when complete, so a crash or a concurrent
+	// load never sees a partial file under the final name
+	static std::atomic<unsigned int> tempCounter{ 0 };
+#ifdef _WIN32
+	const int processID = _getpid();
+#else
+	const int processID = (int)getpid();
+#endif
+	std::string filename = CacheFileName(key);
+	std::string tempName = filename + "." + std::to_string(processID) + "." + std::to_string(tempCounter++) + ".tmp";
+	FILE* fp = fopen(tempName.c_str(), "wb");
+	if (!fp) {
+		printf("WARNING: Cannot write BVH cache file \"%s\"\n", tempName.c_str());
+		return false;
+	}
+
+	BVHCacheHeader header = {};
+	memcpy(header.magic, "BVHC", 4);
+	header.version = BVH_CACHE_VERSION;
+	header.key = key;
+	header.numNodes = bvh.GetNumNodes();
+	header.numElements = bvh.GetNumElements();
+	header.sahCost = bvh.GetSAHCost();
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(&bvh.GetNode(0), sizeof(LinearBVHNode), header.numNodes, fp) == header.numNodes;
+	ok = ok && fwrite(bvh.GetElements(0), sizeof(unsigned int), header.numElements, fp) == header.numElements;
+	ok = fclose(fp) == 0 && ok;
+
+#ifdef _WIN32
+	ok = ok && MoveFileExA(tempName.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	ok = ok && rename(tempName.c_str(), filename.c_str()) == 0;
+#endif
+	if (!ok) remove(tempName.c_str());
+	return ok;
+}
@@ -0,0 +1,53 @@
+#pragma once
+///
+/// \file       bvhCache.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      On-disk cache of built mesh hierarchies
+///
+/// A cache file holds the flattened nodes and the reordered element list of one SAHBVH.
+/// Files are named after a hash of the mesh file contents and the build parameters, so
+/// editing either one simply misses the cache. Cached hierarchies are memory-mapped and
+/// used in place; the mapping is copy-on-write, so refitting never touches the file.
+///
+
+#include <cstdint>
+#include <cstddef>
+#include "bvh.h"
+
+// Read access to a whole file through the virtual memory system
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator = (MappedFile const&) = delete;
+
+	bool   Open(char const* filename);
+	void   Close();
+	char*  Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	char*  data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void*  fileHandle = nullptr;
+	void*  mappingHandle = nullptr;
+#endif
+};
+
+// Sets the directory cache files are read from and written to. An empty string disables the cache.
+void SetBVHCacheDirectory(char const* dir);
+
+// Returns the cache key of a mesh file built with the given parameters, or 0 if the file cannot be read
+uint64_t ComputeBVHCacheKey(char const* filename, BVHBuildParams const& params);
+
+// Attaches the cached hierarchy for the key. Fails if there is no valid cache file, it references more than elementLimit elements,
+// or its nodes point outside the node or element arrays.
+bool LoadBVHCache(uint64_t key, unsigned int elementLimit, BVHBuildParams const& params, SAHBVH& bvh);
+
+// Writes the hierarchy to the cache under the key, through a temporary file that replaces the cache file once complete
+bool SaveBVHCache(uint64_t key, SAHBVH const& bvh);
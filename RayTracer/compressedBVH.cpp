@@ -0,0 +1,84 @@
+///
+/// \file       compressedBVH.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the quantized BVH defined in compressedBVH.h
+///
+
+#include <cmath>
+#include "compressedBVH.h"
+
+bool CompressedBVH::Build(WideBVH<8> const& wide)
+{
+	Clear();
+	if (wide.IsEmpty()) return false;
+
+	for (unsigned int i = 0; i < wide.GetNumNodes(); i++) {
+		WideBVHNode<8> const& node = wide.GetNode(i);
+		for (int c = 0; c < node.numChildren; c++) {
+			if (node.count[c] > 255) return false;
+		}
+	}
+
+	nodes.reserve(wide.GetNumNodes());
+	nodes.push_back(CompressedBVHNode());
+	Quantize(wide, 0, 0);
+	return true;
+}
+
+/*
+* Fills node nodeID from the wide node, then appends its interior children as one block and
+* its leaf children to the leaf table, and recurses into the block.
+*/
+void CompressedBVH::Quantize(WideBVH<8> const& wide, unsigned int wideNodeID, unsigned int nodeID)
+{
+	WideBVHNode<8> const& source = wide.GetNode(wideNodeID);
+	CompressedBVHNode node = {};
+	node.numChildren = (uint8_t)source.numChildren;
+
+	for (int a = 0; a < 3; a++) {
+		float lo = source.bmin[a][0], hi = source.bmax[a][0];
+		for (int i = 1; i < source.numChildren; i++) {
+			lo = std::min(lo, source.bmin[a][i]);
+			hi = std::max(hi, source.bmax[a][i]);
+		}
+
+		// Smallest power of two that spans the box in 255 steps, grown if rounding leaves the last plane short
+		int exponent;
+		frexpf((hi - lo) / 255.0f, &exponent);
+		exponent = std::min(std::max(exponent, -126), 127);
+		while (exponent < 127 && lo + 255.0f * ExponentScale((int8_t)exponent) < hi) exponent++;
+		float scale = ExponentScale((int8_t)exponent);
+		node.origin[a] = lo;
+		node.exponent[a] = (int8_t)exponent;
+
+		// Round the planes outwards, so the decoded box always encloses the child
+		for (int i = 0; i < source.numChildren; i++) {
+			int qlo = (int)std::floor((source.bmin[a][i] - lo) / scale);
+			int qhi = (int)std::ceil((source.bmax[a][i] - lo) / scale);
+			qlo = std::min(std::max(qlo, 0), 255);
+			qhi = std::min(std::max(qhi, 0), 255);
+			while (qlo > 0 && lo + qlo * scale > source.bmin[a][i]) qlo--;
+			while (qhi < 255 && lo + qhi * scale < source.bmax[a][i]) qhi++;
+			node.qmin[a][i] = (uint8_t)qlo;
+			node.qmax[a][i] = (uint8_t)qhi;
+		}
+	}
+
+	node.childBase = (unsigned int)nodes.size();
+	node.leafBase = (unsigned int)leafFirst.size();
+	int numInner = 0;
+	for (int i = 0; i < source.numChildren; i++) {
+		node.count[i] = (uint8_t)source.count[i];
+		if (source.count[i] > 0) leafFirst.push_back(source.child[i]);
+		else numInner++;
+	}
+	nodes.resize(nodes.size() + numInner);
+	nodes[nodeID] = node;
+
+	unsigned int nextChild = node.childBase;
+	for (int i = 0; i < source.numChildren; i++) {
+		if (source.count[i] == 0) Quantize(wide, source.child[i], nextChild++);
+	}
+}
@@ -0,0 +1,203 @@
+#pragma once
+///
+/// \file       compressedBVH.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      8-wide BVH with child boxes quantized to 8 bits per plane
+///
+/// A WideBVH<8> node spends 192 of its 288 bytes on full-float child boxes. This layout stores
+/// each node box as an origin and one power-of-two scale per axis, and the child boxes as 8-bit
+/// multiples of the scale, rounded outwards so they still enclose their elements. Interior
+/// children of a node are stored next to each other and leaf ranges go into a separate table,
+/// so a node only needs two base indices and fits in 80 bytes. Traversal decodes the child
+/// boxes on the fly; the rounding makes them slightly larger, so a few more nodes are visited.
+///
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "wideBVH.h"
+
+struct alignas(16) CompressedBVHNode
+{
+	float        origin[3];		// minimum corner of the node box
+	int8_t       exponent[3];	// per axis, child planes are origin + q * 2^exponent
+	uint8_t      numChildren;
+	unsigned int childBase;		// node index of the first interior child, the others follow it
+	unsigned int leafBase;		// table entry of the first leaf child, the others follow it
+	uint8_t      count[8];		// element count for leaf children, zero for interior children
+	uint8_t      qmin[3][8];	// per axis, the quantized minimum of each child box
+	uint8_t      qmax[3][8];	// per axis, the quantized maximum of each child box
+};
+static_assert(sizeof(CompressedBVHNode) == 80, "CompressedBVHNode must stay 80 bytes");
+
+//-------------------------------------------------------------------------------
+
+class CompressedBVH
+{
+public:
+	static const int width = 8;
+
+	// Quantizes the nodes of the 8-wide layout. Fails if a leaf holds more than 255 elements, which its count cannot store.
+	bool Build(WideBVH<8> const& wide);
+	void Clear() { nodes.clear(); leafFirst.clear(); }
+
+	bool         IsEmpty() const { return nodes.empty(); }
+	unsigned int GetNumNodes() const { return (unsigned int)nodes.size(); }
+	size_t       GetMemoryUsage() const { return nodes.size() * sizeof(CompressedBVHNode) + leafFirst.size() * sizeof(unsigned int); }
+
+	// Tests the child boxes of a node like IntersectChildren, and writes the child node index or first element slot,
+	// and the element count (zero for interior children) of every child
+	int IntersectChildren(unsigned int nodeID, Ray const& ray, float t_max, float* tNear, unsigned int* child, unsigned int* count) const;
+
+private:
+	std::vector<CompressedBVHNode> nodes;
+	std::vector<unsigned int>      leafFirst;	// first element slot of the binary hierarchy, per leaf child
+
+	void Quantize(WideBVH<8> const& wide, unsigned int wideNodeID, unsigned int nodeID);
+};
+
+//-------------------------------------------------------------------------------
+
+// 2^exponent, built from the exponent bits directly
+inline float ExponentScale(int8_t exponent)
+{
+	uint32_t bits = (uint32_t)(exponent + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+// Turns the quantized planes of each axis into ray distances of the form t = q * slope + offset,
+// and picks the near and far planes by the ray direction signs
+struct QuantizedSlabs
+{
+	float slope[3], offset[3];
+	uint8_t const* nearPlane[3];
+	uint8_t const* farPlane[3];
+
+	QuantizedSlabs(CompressedBVHNode const& node, Ray const& ray)
+	{
+		for (int a = 0; a < 3; a++) {
+			slope[a] = ExponentScale(node.exponent[a]) * ray.invDir[a];
+			offset[a] = node.origin[a] * ray.invDir[a] - ray.pInvDir[a];
+			nearPlane[a] = ray.sign[a] ? node.qmax[a] : node.qmin[a];
+			farPlane[a] = ray.sign[a] ? node.qmin[a] : node.qmax[a];
+		}
+	}
+};
+
+inline int SlabTestQuantizedScalar(CompressedBVHNode const& node, Ray const& ray, float t_max, float* tNear)
+{
+	QuantizedSlabs slabs(node, ray);
+	int mask = 0;
+	for (int i = 0; i < node.numChildren; i++) {
+		float tmin = 0.0f, tmax = t_max;
+		for (int a = 0; a < 3; a++) {
+			tmin = std::max(tmin, slabs.nearPlane[a][i] * slabs.slope[a] + slabs.offset[a]);
+			tmax = std::min(tmax, slabs.farPlane[a][i] * slabs.slope[a] + slabs.offset[a]);
+		}
+		tNear[i] = tmin;
+		if (tmin <= tmax) mask |= 1 << i;
+	}
+	return mask;
+}
+
+#if SIMD_X86
+
+// Widens the 8 bytes at q to two vectors of 4 floats
+inline void LoadQuantized8(uint8_t const* q, __m128& lo, __m128& hi)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)q), zero);
+	lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+	hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+}
+
+inline int SlabTestQuantized4x2(CompressedBVHNode const& node, Ray const& ray, float t_max, float* tNear)
+{
+	QuantizedSlabs slabs(node, ray);
+	int mask = 0;
+	for (int half = 0; half < 2; half++) {
+		__m128 tmin = _mm_setzero_ps();
+		__m128 tmax = _mm_set1_ps(t_max);
+		for (int a = 0; a < 3; a++) {
+			__m128 slope = _mm_set1_ps(slabs.slope[a]);
+			__m128 offset = _mm_set1_ps(slabs.offset[a]);
+			__m128 qnear[2], qfar[2];
+			LoadQuantized8(slabs.nearPlane[a], qnear[0], qnear[1]);
+			LoadQuantized8(slabs.farPlane[a], qfar[0], qfar[1]);
+			tmin = _mm_max_ps(tmin, _mm_add_ps(_mm_mul_ps(qnear[half], slope), offset));
+			tmax = _mm_min_ps(tmax, _mm_add_ps(_mm_mul_ps(qfar[half], slope), offset));
+		}
+		_mm_storeu_ps(tNear + 4 * half, tmin);
+		mask |= _mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) << (4 * half);
+	}
+	return mask;
+}
+
+SIMD_TARGET_AVX inline __m256 LoadQuantized8x(uint8_t const* q)
+{
+	__m128 lo, hi;
+	LoadQuantized8(q, lo, hi);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+SIMD_TARGET_AVX inline int SlabTestQuantized8(CompressedBVHNode const& node, Ray const& ray, float t_max, float* tNear)
+{
+	QuantizedSlabs slabs(node, ray);
+	__m256 tmin = _mm256_setzero_ps();
+	__m256 tmax = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256 slope = _mm256_set1_ps(slabs.slope[a]);
+		__m256 offset = _mm256_set1_ps(slabs.offset[a]);
+		tmin = _mm256_max_ps(tmin, _mm256_add_ps(_mm256_mul_ps(LoadQuantized8x(slabs.nearPlane[a]), slope), offset));
+		tmax = _mm256_min_ps(tmax, _mm256_add_ps(_mm256_mul_ps(LoadQuantized8x(slabs.farPlane[a]), slope), offset));
+	}
+	_mm256_storeu_ps(tNear, tmin);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+
+// SlabTestQuantized8 with fused multiply-adds, for CPUs with AVX2 and FMA
+SIMD_TARGET_AVX2 inline int SlabTestQuantized8FMA(CompressedBVHNode const& node, Ray const& ray, float t_max, float* tNear)
+{
+	QuantizedSlabs slabs(node, ray);
+	__m256 tmin = _mm256_setzero_ps();
+	__m256 tmax = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256 slope = _mm256_set1_ps(slabs.slope[a]);
+		__m256 offset = _mm256_set1_ps(slabs.offset[a]);
+		tmin = _mm256_max_ps(tmin, _mm256_fmadd_ps(LoadQuantized8x(slabs.nearPlane[a]), slope, offset));
+		tmax = _mm256_min_ps(tmax, _mm256_fmadd_ps(LoadQuantized8x(slabs.farPlane[a]), slope, offset));
+	}
+	_mm256_storeu_ps(tNear, tmin);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+
+#endif
+
+inline int CompressedBVH::IntersectChildren(unsigned int nodeID, Ray const& ray, float t_max, float* tNear, unsigned int* child, unsigned int* count) const
+{
+	BVH_TOUCH_NODE(&nodes[nodeID]);
+	CompressedBVHNode const& node = nodes[nodeID];
+
+#if SIMD_X86
+	int mask;
+	if (GetCPUFeatures().avx2) mask = SlabTestQuantized8FMA(node, ray, t_max, tNear);
+	else if (GetCPUFeatures().avx) mask = SlabTestQuantized8(node, ray, t_max, tNear);
+	else mask = SlabTestQuantized4x2(node, ray, t_max, tNear);
+	mask &= (1 << node.numChildren) - 1;
+#else
+	int mask = SlabTestQuantizedScalar(node, ray, t_max, tNear);
+#endif
+
+	unsigned int nextChild = node.childBase;
+	unsigned int nextLeaf = node.leafBase;
+	for (int i = 0; i < node.numChildren; i++) {
+		count[i] = node.count[i];
+		child[i] = count[i] > 0 ? leafFirst[nextLeaf++] : nextChild++;
+	}
+	return mask;
+}
@@ -0,0 +1,159 @@
+///
+/// \file       lightBVH.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the light hierarchy defined in lightBVH.h
+///
+
+#include <algorithm>
+#include "lightBVH.h"
+#include "lights.h"
+
+// Keeps the random number below one after it is rescaled to the chosen branch
+static const float oneMinusEpsilon = 0.99999994f;
+
+/**
+ * Collects the point lights and builds a hierarchy with one light per leaf over their
+ * bounds. Other lights (ambient, direct) stay outside and are always evaluated.
+ *
+ * @param sceneLights  Light list of the scene, Sample returns indices into it.
+ */
+void LightBVH::Build(std::vector<Light*> const& sceneLights)
+{
+	Clear();
+
+	std::vector<Box> bounds;
+	for (int i = 0; i < (int)sceneLights.size(); i++)
+	{
+		PointLight const* pointLight = dynamic_cast<PointLight const*>(sceneLights[i]);
+		if (!pointLight) continue;
+
+		LightInfo info;
+		info.index = i;
+		info.position = pointLight->GetPosition();
+		info.radius = pointLight->GetSize();
+		info.power = std::max(pointLight->Intensity().Gray(), 0.0f);
+		info.attenuated = pointLight->IsAttenuated();
+		lights.push_back(info);
+		bounds.push_back(Box(info.position - info.radius, info.position + info.radius));
+	}
+
+	if ((int)lights.size() < minClusteredLights)
+	{
+		Clear();
+		return;
+	}
+
+	slotOf.assign(sceneLights.size(), -1);
+	for (int i = 0; i < (int)lights.size(); i++) slotOf[lights[i].index] = i;
+
+	BVHBuildParams params;
+	params.maxLeafSize = 1;
+	bvh.Build(bounds, params);
+
+	// Children follow their parent in the node array, so a reverse sweep sums the power bottom-up
+	nodePower.assign(bvh.GetNumNodes(), NodePower());
+	for (unsigned int nodeID = bvh.GetNumNodes(); nodeID-- > 0;)
+	{
+		NodePower& power = nodePower[nodeID];
+		if (bvh.IsLeafNode(nodeID))
+		{
+			unsigned int const* elements = bvh.GetNodeElements(nodeID);
+			for (unsigned int i = 0; i < bvh.GetNodeElementCount(nodeID); i++)
+			{
+				LightInfo const& light = lights[elements[i]];
+				(light.attenuated ? power.attenuated : power.constant) += light.power;
+			}
+		}
+		else
+		{
+			unsigned int child1, child2;
+			bvh.GetChildNodes(nodeID, child1, child2);
+			power.attenuated = nodePower[child1].attenuated + nodePower[child2].attenuated;
+			power.constant = nodePower[child1].constant + nodePower[child2].constant;
+		}
+	}
+}
+
+void LightBVH::Clear()
+{
+	bvh.Clear();
+	lights.clear();
+	nodePower.clear();
+	slotOf.clear();
+}
+
+/**
+ * Walks from the root to a leaf, choosing each child with probability proportional to its
+ * importance and reusing the random number for the next choice, then picks a light of the
+ * leaf the same way.
+ */
+int LightBVH::Sample(Vec3f const& p, float u, float& prob) const
+{
+	prob = 1.0f;
+	if (bvh.IsEmpty()) return -1;
+
+	unsigned int nodeID = bvh.GetRootNodeID();
+	while (!bvh.IsLeafNode(nodeID))
+	{
+		unsigned int child1, child2;
+		bvh.GetChildNodes(nodeID, child1, child2);
+		float importance1 = Importance(child1, p);
+		float importance2 = Importance(child2, p);
+		float total = importance1 + importance2;
+		if (!(total > 0.0f)) return -1;
+
+		float p1 = importance1 / total;
+		if (u < p1)
+		{
+			u = std::min(u / p1, oneMinusEpsilon);
+			prob *= p1;
+			nodeID = child1;
+		}
+		else
+		{
+			u = std::min((u - p1) / (1.0f - p1), oneMinusEpsilon);
+			prob *= 1.0f - p1;
+			nodeID = child2;
+		}
+	}
+
+	unsigned int const* elements = bvh.GetNodeElements(nodeID);
+	unsigned int count = bvh.GetNodeElementCount(nodeID);
+	float total = 0.0f;
+	for (unsigned int i = 0; i < count; i++) total += Importance(lights[elements[i]], p);
+	if (!(total > 0.0f)) return -1;
+
+	float target = u * total;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		float importance = Importance(lights[elements[i]], p);
+		if (target < importance || i == count - 1)
+		{
+			prob *= importance / total;
+			return importance > 0.0f ? lights[elements[i]].index : -1;
+		}
+		target -= importance;
+	}
+	return -1;
+}
+
+// Power of the node over the squared distance to its center, which is not allowed to get closer than half the box diagonal
+float LightBVH::Importance(unsigned int nodeID, Vec3f const& p) const
+{
+	float const* bounds = bvh.GetNodeBounds(nodeID);
+	Vec3f pmin(bounds[0], bounds[1], bounds[2]);
+	Vec3f pmax(bounds[3], bounds[4], bounds[5]);
+	float distSq = (p - (pmin + pmax) * 0.5f).LengthSquared();
+	float halfDiagSq = (pmax - pmin).LengthSquared() * 0.25f;
+	NodePower const& power = nodePower[nodeID];
+	return power.attenuated / std::max(distSq, std::max(halfDiagSq, 1e-4f)) + power.constant;
+}
+
+float LightBVH::Importance(LightInfo const& light, Vec3f const& p) const
+{
+	if (!light.attenuated) return light.power;
+	float distSq = (p - light.position).LengthSquared();
+	return light.power / std::max(distSq, std::max(light.radius * light.radius, 1e-4f));
+}
@@ -0,0 +1,65 @@
+#pragma once
+///
+/// \file       lightBVH.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Hierarchy over the point lights of a scene for picking lights by importance
+///
+/// Shading a point evaluates every light, and each point light fires its own batch of shadow
+/// rays, so with hundreds of lights shading cost grows with the light count. The light BVH
+/// clusters the point lights by position and stores the total power under each node. A
+/// shading point walks down from the root, choosing a child in proportion to its estimated
+/// contribution (power over squared distance), so it reaches one light in a logarithmic
+/// number of steps and knows the probability of having picked it.
+///
+
+#include <vector>
+#include "scene.h"
+#include "bvh.h"
+
+class LightBVH
+{
+public:
+	const int minClusteredLights = 16;	// with fewer point lights than this, every light is evaluated
+	const int samplesPerShade = 4;		// lights picked from the hierarchy per shading point
+
+	// Builds the hierarchy over the point lights of the list, if there are enough of them
+	void Build(std::vector<Light*> const& lights);
+	void Clear();
+
+	bool IsEmpty() const { return bvh.IsEmpty(); }
+
+	// True if the light with the given index in the scene light list is in the hierarchy,
+	// so it is only shaded when Sample picks it
+	bool IsClustered(int lightIndex) const { return lightIndex < (int)slotOf.size() && slotOf[lightIndex] >= 0; }
+
+	// Picks one clustered light for shading point p with the random number u in [0,1).
+	// Returns its index in the scene light list and the probability it was picked with, or -1 if none can be picked.
+	int Sample(Vec3f const& p, float u, float& prob) const;
+
+private:
+	struct LightInfo
+	{
+		int   index;		// in the scene light list
+		Vec3f position;
+		float radius;
+		float power;
+		bool  attenuated;	// falls off with the squared distance
+	};
+
+	// Power under a node, split by whether it falls off with distance
+	struct NodePower
+	{
+		float attenuated = 0.0f;
+		float constant = 0.0f;
+	};
+
+	SAHBVH                 bvh;
+	std::vector<LightInfo> lights;		// the elements of the hierarchy
+	std::vector<NodePower> nodePower;	// per hierarchy node
+	std::vector<int>       slotOf;		// per scene light, its element in lights, -1 if not clustered
+
+	float Importance(unsigned int nodeID, Vec3f const& p) const;
+	float Importance(LightInfo const& light, Vec3f const& p) const;
+};
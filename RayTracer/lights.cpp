@@ -50,7 +50,7 @@ Color PointLight::Illuminate(ShadeInfo const& sInfo, Vec3f& dir)  const
 		float dist = toLight.Length();
 		Vec3f shadowRayDir = toLight / dist;
 
-		summedLight += sInfo.TraceShadowRay(Ray(sInfo.P(), shadowRayDir), dist);
+		summedLight += sInfo.TraceShadowRay(Ray(sInfo.P(), shadowRayDir), dist, this);
 		numSamples++;
 
 		if (numSamples == sInfo.minShadowSamples && summedLight == numSamples)
@@ -124,6 +124,14 @@ inline float ShadowInfo::TraceShadowRay(Ray const& ray, float t_max) const
 	return renderer->TraceShadowRay(ray, t_max) ? 0.0f : 1.0f;
 }
 
+/**
+ * Same as above for a ray toward the given light, which goes through the occluder cache of the light.
+ */
+float ShadowInfo::TraceShadowRay(Ray const& ray, float t_max, Light const* light) const
+{
+	return renderer->TraceShadowRay(ray, t_max, light) ? 0.0f : 1.0f;
+}
+
 /**
 * Returns if a given shade ray can bounce again
 */
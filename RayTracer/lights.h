@@ -42,7 +42,7 @@ protected:
 class DirectLight : public GenLight
 {
 public:
-    Color Illuminate(ShadeInfo const& sInfo, Vec3f& dir) const override { dir = -direction; return intensity * sInfo.TraceShadowRay(-direction); }
+    Color Illuminate(ShadeInfo const& sInfo, Vec3f& dir) const override { dir = -direction; return intensity * sInfo.TraceShadowRay(Ray(sInfo.P(), -direction), BIGFLOAT, this); }
     Color Intensity() const override { return intensity; }
     void  SetViewportLight(int lightID) const override { SetViewportParam(lightID, ColorA(0.0f), ColorA(intensity), Vec4f(-direction, 0.0f)); }
     void  Load(Loader const& loader) override;
@@ -69,6 +69,10 @@ public:
     Box  GetBoundBox() const override { return Box(position - size, position + size); }
     void ViewportDisplay(Material const* mtl) const override; // used for OpenGL display
 
+    Vec3f GetPosition() const { return position; }
+    float GetSize() const { return size; }
+    bool  IsAttenuated() const { return attenuation != 0.0f; }  // intensity falls off with the squared distance
+
 protected:
     Color intensity = Color(0, 0, 0);
     Vec3f position = Vec3f(0, 0, 0);
@@ -5,10 +5,32 @@
 #include "xmlload.h"
 #include "objects.h"
 #include "raytracer.h"
+#include "wavefront.h"
+#include "bvhBenchmark.h"
+#include <cstring>
 
-int main()
+int main(int argc, char** argv)
 {
-	Renderer* theRenderer = new RayTracer();
+	// -wavefront renders with the staged renderer instead of the recursive one,
+	// -sortrays sorts photon rays and the secondary rays of the staged renderer before tracing them,
+	// -bvhbench compares the BVH layouts on the meshes of the scene instead of rendering,
+	// -refitcheck checks that refitting the scene hierarchy after moving nodes matches a rebuild
+	bool wavefront = false, sortRays = false, bvhBench = false, refitCheck = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-wavefront") == 0) wavefront = true;
+		else if (strcmp(argv[i], "-sortrays") == 0) sortRays = true;
+		else if (strcmp(argv[i], "-bvhbench") == 0) bvhBench = true;
+		else if (strcmp(argv[i], "-refitcheck") == 0) refitCheck = true;
+	}
+	RayTracer* theRenderer = wavefront ? new WavefrontTracer() : new RayTracer();
+	theRenderer->SetSortRays(sortRays);
 	theRenderer->LoadScene("scenes/finalProject.xml");
+	if (bvhBench)
+	{
+		BenchmarkBVHLayouts(theRenderer->GetScene().objList);
+		return 0;
+	}
+	if (refitCheck) return CheckSceneRefit(theRenderer->GetScene().rootNode) ? 0 : 1;
     ShowViewport(theRenderer);
 }
\ No newline at end of file
@@ -14,6 +14,7 @@
 #include "raytracer.h"
 #include "shadowInfo.h"
 #include "photonmap.h"
+#include "lightBVH.h"
 #include <iostream>
 
 /**
@@ -102,9 +103,9 @@ Ray RefractRay(float ior, SamplerInfo const& info, Color absorption, TexturedFlo
 		float NdotV = refractView.Dot(HTransformed);
 		cosThetaT = sqrtf(1 - etaSq * (1 - NdotV * NdotV));
 		refractDir = -eta * refractView - (cosThetaT - eta * NdotV) * HTransformed;
-		refract = Ray(info.P(), refractDir.GetNormalized());
-		float sign = refract.dir.Dot(info.N()) > 0.0f ? 1.0f : -1.0f;
-		refract.p += info.N() * (eps * sign);
+		refractDir.Normalize();
+		float sign = refractDir.Dot(info.N()) > 0.0f ? 1.0f : -1.0f;
+		refract = Ray(info.P() + info.N() * (eps * sign), refractDir);
 	}
 	else
 	{
@@ -124,9 +125,9 @@ Ray RefractRay(float ior, SamplerInfo const& info, Color absorption, TexturedFlo
 
 		cosThetaT = sqrtf(cosThetaSquared);
 		refractDir = -eta * refractView - (cosThetaT - eta * NdotV) * H_back;
-		refract = Ray(info.P(), refractDir.GetNormalized());
-		float sign = refract.dir.Dot(negN) > 0.0f ? 1.0f : -1.0f;
-		refract.p += negN * (eps * sign);
+		refractDir.Normalize();
+		float sign = refractDir.Dot(negN) > 0.0f ? 1.0f : -1.0f;
+		refract = Ray(info.P() + negN * (eps * sign), refractDir);
 	}
 
 	return refract;
@@ -212,97 +213,156 @@ Color SampleIndirectDiffuseCosin(ShadeInfo const& info)
 }
 
 /**
- * Computes the shaded color at a surface point using the Blinn-Phong model.
- * Includes diffuse, specular, ambient, reflection, and refraction contributions,
- * with recursive ray tracing for reflective and refractive materials.
- *
- * @param ShadeInfo     Surface hit information with lights and view direction
- * @return Final shaded color at the hit point.
+ * Returns the photon map irradiance at a shading point. Secondary hits only gather caustics,
+ * the global map is gathered at the first hit.
  */
-Color MtlBlinn::Shade(ShadeInfo const &info) const
+Color GatherPhotonIrradiance(Renderer const* renderer, bool isSecondary, Vec3f const& p, Vec3f const& n)
 {
-	//Summation Colors
-	Color finalColor(0, 0, 0), ambientLight(0, 0, 0), reflectCol(0, 0, 0), refractCol(0, 0, 0),
-		  fresnel(0, 0, 0), indirect(0,0,0), irradiance(0,0,0), irradianceCaustic(0,0,0);
-
+	Color irradiance(0, 0, 0);
 	cyVec3f photonDir(0, 0, 0);
+	if (isSecondary)
+		renderer->GetCausticsMap()->EstimateIrradiance<128>(irradiance, photonDir, 3.0f, p, n, 0.25f);
+	else
+		renderer->GetPhotonMap()->EstimateIrradiance<128>(irradiance, photonDir, 3.0f, p, n, 1.0f);
+	return irradiance;
+}
 
-	//Material Colors
+/**
+ * Samples the refracted ray of a hit point, if the material refracts and the ray can bounce.
+ * The traced color is scaled by lobe.weight after absorption over the traced distance.
+ *
+ * @param info            Surface hit information.
+ * @param lobe            Output ray and weight.
+ * @param fullReflection  Output reflection color including the Fresnel term of the refraction.
+ * @return True if the refracted ray should be traced.
+ */
+bool MtlBlinn::SampleRefraction(ShadeInfo const& info, Lobe& lobe, Color& fullReflection) const
+{
 	Color reflection = this->Reflection().Eval(info.UVW());
 	Color refraction = this->Refraction().Eval(info.UVW());
+	float matior = this->ior;
+	fullReflection = reflection;
+
+	if (!(matior > 0.0f && info.CanBounce() && refraction != Color(0, 0, 0))) return false;
+
+	lobe.ray = RefractRay(this->ior, info, this->absorption, this->glossiness);
+	lobe.reflection = false;
+
+	//Fresnel Effect
+	float iorRatio = (1.0f - matior) / (1.0f + matior);
+	Color fresnel = refraction * (iorRatio * iorRatio);
+	fullReflection = fullReflection + fresnel;
+	lobe.weight = refraction * (Color(1, 1, 1) - fullReflection);
+	return true;
+}
+
+/**
+ * Samples the reflected ray of a hit point, if there is any reflection and the ray can bounce.
+ *
+ * @param info            Surface hit information.
+ * @param fullReflection  Reflection color returned by SampleRefraction.
+ * @param lobe            Output ray and weight.
+ * @return True if the reflected ray should be traced.
+ */
+bool MtlBlinn::SampleReflection(ShadeInfo const& info, Color const& fullReflection, Lobe& lobe) const
+{
+	if (!(fullReflection != Color(0, 0, 0) && info.CanBounce())) return false;
+
+	lobe.ray = ReflectRay(info, HIT_FRONT_AND_BACK, this->absorption, this->glossiness);
+	lobe.reflection = true;
+	lobe.weight = this->Reflection().Eval(info.UVW());
+	return true;
+}
+
+/**
+ * Returns the energy conserving Blinn-Phong BRDF times the cosine term for light arriving from lightDir.
+ */
+Color MtlBlinn::EvalBRDF(ShadeInfo const& info, Vec3f const& lightDir) const
+{
 	Color kd = this->Diffuse().Eval(info.UVW());
 	Color ks = this->Specular().Eval(info.UVW());
 	float alpha = this->Glossiness().Eval(info.UVW());
-	Color emission = this->Emission().Eval(info.UVW());
 
 	//Energy Conservation
 	float diffScalar = (1 / M_PI);
 	float specScalar = (alpha + 2) / (8 * M_PI);
 	Color cKd = kd * diffScalar;
 	Color cKs = ks * specScalar;
-	Color fullReflection = reflection;
-	float matior = this->ior;
 
-	bool needsRefraction = (matior > 0.0f && info.CanBounce() && refraction != Color(0, 0, 0));
+	//Calculate Half vector and angles
+	cyVec3f h = (lightDir + info.V()).GetNormalized();
+	float cosphi = std::max(info.N().Dot(h), 0.0f);
+	float costheta = std::max(lightDir.Dot(info.N()), 0.0f);
 
-	//Sum Refraction Colors
-	if (needsRefraction)
-	{
-		float dist;
-		Ray refract = RefractRay(this->ior, info, this->absorption, this->glossiness);
+	return (costheta * cKd) + (cKs * pow(cosphi, alpha));
+}
 
-		refractCol = info.TraceSecondaryRay(refract, dist, false);
-		if (dist > 0.0f && (absorption.r > 0.0f || absorption.g > 0.0f || absorption.b > 0.0f)) {
-			refractCol.r *= expf(-absorption.r * dist);
-			refractCol.g *= expf(-absorption.g * dist);
-			refractCol.b *= expf(-absorption.b * dist);
-		}
+// Scales a traced color by the absorption over the distance it traveled inside the material
+Color Absorb(Color c, Color const& absorption, float dist)
+{
+	if (dist > 0.0f && (absorption.r > 0.0f || absorption.g > 0.0f || absorption.b > 0.0f)) {
+		c.r *= expf(-absorption.r * dist);
+		c.g *= expf(-absorption.g * dist);
+		c.b *= expf(-absorption.b * dist);
+	}
+	return c;
+}
 
-		TexturedColor texRefractCol = refractCol;
-		refractCol = refraction * texRefractCol.Eval(info.UVW());
+/**
+ * Computes the shaded color at a surface point using the Blinn-Phong model.
+ * Includes diffuse, specular, ambient, reflection, and refraction contributions,
+ * with recursive ray tracing for reflective and refractive materials.
+ *
+ * @param ShadeInfo     Surface hit information with lights and view direction
+ * @return Final shaded color at the hit point.
+ */
+Color MtlBlinn::Shade(ShadeInfo const &info) const
+{
+	//Summation Colors
+	Color finalColor(0, 0, 0), reflectCol(0, 0, 0), refractCol(0, 0, 0), indirect(0, 0, 0);
+	Color fullReflection;
+	Lobe lobe;
 
-		//Fresnel Effect
-		float iorRatio = (1.0f - matior) / (1.0f + matior);
-		Color fresnel = refraction * (iorRatio * iorRatio);
-		fullReflection = fullReflection + fresnel;
-		refractCol = refractCol * (Color(1, 1, 1) - fullReflection);
+	//Sum Refraction Colors
+	if (SampleRefraction(info, lobe, fullReflection))
+	{
+		float dist;
+		refractCol = lobe.weight * Absorb(info.TraceSecondaryRay(lobe.ray, dist, false), absorption, dist);
 	}
 
 	//Sum Reflection colors
-	if (fullReflection != Color(0,0,0) && info.CanBounce())
+	if (SampleReflection(info, fullReflection, lobe))
 	{
 		float dist;
-		Ray reflect = ReflectRay(info, HIT_FRONT_AND_BACK, this->absorption, this->glossiness);
-		reflectCol = info.TraceSecondaryRay(reflect, dist, true);
-		if (dist > 0.0f && (absorption.r > 0.0f || absorption.g > 0.0f || absorption.b > 0.0f)) {
-			reflectCol.r *= expf(-absorption.r * dist);
-			reflectCol.g *= expf(-absorption.g * dist);
-			reflectCol.b *= expf(-absorption.b * dist);
-		}
-
-		TexturedColor texReflectCol = reflectCol;
-		reflectCol = reflection * texReflectCol.Eval(info.UVW());
+		reflectCol = lobe.weight * Absorb(info.TraceSecondaryRay(lobe.ray, dist, true), absorption, dist);
 	}
 	
-	//Sum Diffuse + Specular Colors
+	//Sum Diffuse + Specular Colors, ambient lights are not part of the BRDF.
+	//Lights in the light hierarchy are only shaded when they are picked below.
+	LightBVH const* lightBVH = info.GetRenderer() ? info.GetRenderer()->GetLightBVH() : nullptr;
 	for (int i = 0; i < info.NumLights(); i++)
 	{
+		if (lightBVH && lightBVH->IsClustered(i)) continue;
 		const Light* light = info.GetLight(i);
 		cyVec3f lightDir;
 		Color lightIntensity = light->Illuminate(info, lightDir);
-		if (light->IsAmbient())
+		if (!light->IsAmbient())
 		{
-			ambientLight += lightIntensity;
+			finalColor += lightIntensity * EvalBRDF(info, lightDir);
 		}
-		else
-		{
-			//Calculate Half vector and angles
-			cyVec3f h = (lightDir + info.V()).GetNormalized();
-			float cosphi = std::max(info.N().Dot(h), 0.0f);
-			float costheta = std::max(lightDir.Dot(info.N()), 0.0f);
+	}
 
-			//Full BRDF
-			finalColor += (lightIntensity * ((costheta * cKd) + (cKs * pow(cosphi, alpha))));
+	//Pick a few of the clustered lights by importance, each weighted by one over its probability
+	if (lightBVH)
+	{
+		for (int s = 0; s < lightBVH->samplesPerShade; s++)
+		{
+			float prob;
+			int i = lightBVH->Sample(info.P(), info.RandomFloat(), prob);
+			if (i < 0) break;
+			cyVec3f lightDir;
+			Color lightIntensity = info.GetLight(i)->Illuminate(info, lightDir);
+			finalColor += lightIntensity * EvalBRDF(info, lightDir) / (prob * lightBVH->samplesPerShade);
 		}
 	}
 
@@ -312,21 +372,15 @@ Color MtlBlinn::Shade(ShadeInfo const &info) const
 	//}
 	//else
 	//{
-		if (info.isSecondary) {
-			info.GetRenderer()->GetCausticsMap()->EstimateIrradiance<128>(irradianceCaustic, photonDir, 3.0f, info.P(), info.N(), 0.25f);
-			indirect += (1.0f / M_PI) * kd * irradianceCaustic;
-		}
-		else {
-			info.GetRenderer()->GetPhotonMap()->EstimateIrradiance<128>(irradiance, photonDir, 3.0f, info.P(), info.N(), 1.0f);
-			indirect += (1.0f / M_PI) * kd * irradiance;
-		}
+		Color kd = this->Diffuse().Eval(info.UVW());
+		indirect += (1.0f / M_PI) * kd * GatherPhotonIrradiance(info.GetRenderer(), info.isSecondary, info.P(), info.N());
 	//}
 
 	//Summing final components
 	finalColor += indirect;
 	finalColor += reflectCol;
 	finalColor += refractCol;
-	finalColor += emission;
+	finalColor += this->Emission().Eval(info.UVW());
 	return finalColor;
 }
 
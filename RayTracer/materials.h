@@ -80,8 +80,21 @@ public:
     void SetViewportMaterial(int mtlID = 0) const override;    // used for OpenGL display
 
     bool GenerateSample(SamplerInfo const& sInfo, Vec3f& dir, Info& si) const override;
+
+    // The parts Shade is made of, so renderers can trace the secondary and shadow rays of many hit points in batches.
+    // The color found along a lobe ray is absorbed over the traced distance and then scaled by the lobe weight.
+    struct Lobe { Ray ray; Color weight; bool reflection; };
+    bool  SampleRefraction(ShadeInfo const& info, Lobe& lobe, Color& fullReflection) const;
+    bool  SampleReflection(ShadeInfo const& info, Color const& fullReflection, Lobe& lobe) const;
+    Color EvalBRDF(ShadeInfo const& info, Vec3f const& lightDir) const;    // multiplies the intensity of a non-ambient light
 };
 
+// Irradiance from the photon maps of the renderer, shaded by MtlBlinn as (1/pi) * diffuse * irradiance
+Color GatherPhotonIrradiance(Renderer const* renderer, bool isSecondary, Vec3f const& p, Vec3f const& n);
+
+// Scales a color traced along a lobe ray by the absorption over dist, dist is zero unless the ray hit a front face
+Color Absorb(Color c, Color const& absorption, float dist);
+
 //-------------------------------------------------------------------------------
 
 class MtlMicrofacet : public Material
@@ -126,7 +139,9 @@ private:
 class MultiMtl : public Material
 {
 public:
-    virtual ~MultiMtl() { for (Material* m : mtls) delete m; }
+    // A multi-material that does not own its sub-materials only references materials kept elsewhere (e.g. the scene material list)
+    MultiMtl(bool ownsMaterials = true) : owns(ownsMaterials) {}
+    virtual ~MultiMtl() { if (owns) for (Material* m : mtls) delete m; }
 
     Color Shade(ShadeInfo const& sInfo) const override { int m = sInfo.MaterialID(); return m < (int)mtls.size() ? mtls[m]->Shade(sInfo) : Color(1, 1, 1); }
     Color Absorption(int mtlID = 0) const override { return mtlID < (int)mtls.size() ? mtls[mtlID]->Absorption(mtlID) : Material::Absorption(mtlID); }
@@ -135,6 +150,8 @@ public:
     void  SetViewportMaterial(int mtlID = 0) const override { if (mtlID < (int)mtls.size()) mtls[mtlID]->SetViewportMaterial(); }
 
     void AppendMaterial(Material* m) { mtls.push_back(m); }
+    int  NumMaterials() const { return (int)mtls.size(); }
+    Material* GetMaterial(int mtlID) const { return mtls[mtlID]; }
 
     bool GenerateSample(SamplerInfo const& sInfo, Vec3f& dir, Info& si) const override
     {
@@ -145,6 +162,7 @@ public:
 
 private:
     std::vector<Material*> mtls;
+    bool owns;
 };
 
 //-------------------------------------------------------------------------------
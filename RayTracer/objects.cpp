@@ -8,16 +8,39 @@
 
 #define _USE_MATH_DEFINES
 #include <iostream>
+#include <cstdio>
 #include <cmath>
 #include <limits>
 #include "objects.h"
 #include "lights.h"
+#include "bvhCache.h"
+#include "rayPacket.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Object
+////////////////////////////////////////////////////////////////////////////////
+
+bool Object::IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide) const {
+    HitInfo hInfo;
+    hInfo.z = hit.z;
+    if (!IntersectRay(ray, hInfo, hitSide)) return false;
+    hit.z = hInfo.z;
+    return true;
+}
+
+bool Object::IntersectRayWithRecord(Ray const& ray, HitInfo& hInfo, int hitSide) const {
+    HitRecord hit;
+    hit.z = hInfo.z;
+    if (!IntersectRecord(ray, hit, hitSide)) return false;
+    EvaluateHit(ray, hit, hitSide, hInfo);
+    return true;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Sphere
 ////////////////////////////////////////////////////////////////////////////////
 
-bool Sphere::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const {
+bool Sphere::IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide) const {
     cyVec3f q(0.0f, 0.0f, 0.0f);
     constexpr int r = 1;
 	constexpr float eps = 0.002f;
@@ -33,26 +56,14 @@ bool Sphere::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const {
     float t2 = (-b + sqrt_disc) / (twoA);
 
     if (t1 > eps && hitSide & HIT_FRONT) {
-        if (hInfo.z > t1) {
-            hInfo.z = t1;
-            hInfo.p = ray.p + (ray.dir * t1);
-            hInfo.N = hInfo.p.GetNormalized();
-            float tu = (atan2(hInfo.p.y, hInfo.p.x) / (2 * M_PI)) + .5;
-            float tv = asin(hInfo.p.z) / M_PI + .5;
-            hInfo.uvw = cyVec3f(tu, tv, 0.0f);
-            hInfo.front = true;
+        if (hit.z > t1) {
+            hit.z = t1;
             return true;
         }
     }
     else if (t2 >= eps && hitSide & HIT_BACK) {
-        if (hInfo.z > t2) {
-            hInfo.z = t2;
-            hInfo.p = ray.p + (ray.dir * t2);
-            hInfo.N = hInfo.p.GetNormalized();
-            float tu = (atan2(hInfo.p.y, hInfo.p.x) / (2 * M_PI)) + .5;
-			float tv = asin(hInfo.p.z) / M_PI + .5;
-			hInfo.uvw = cyVec3f(tu, tv, 0.0f);
-            hInfo.front = false;
+        if (hit.z > t2) {
+            hit.z = t2;
             return true;
         }
     }
@@ -60,6 +71,19 @@ bool Sphere::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const {
     return false;
 }
 
+/*
+* A front hit enters the sphere and a back hit leaves it, so the side follows from the normal
+*/
+void Sphere::EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const {
+    hInfo.z = hit.z;
+    hInfo.p = ray.p + (ray.dir * hit.z);
+    hInfo.N = hInfo.p.GetNormalized();
+    float tu = (atan2(hInfo.p.y, hInfo.p.x) / (2 * M_PI)) + .5;
+    float tv = asin(hInfo.p.z) / M_PI + .5;
+    hInfo.uvw = cyVec3f(tu, tv, 0.0f);
+    hInfo.front = ray.dir.Dot(hInfo.N) < 0;
+}
+
 bool Sphere::ShadowRay(Ray const& ray, float t_max) const {
     cyVec3f q(0.0f, 0.0f, 0.0f);
     constexpr int r = 1;
@@ -85,70 +109,53 @@ bool Sphere::ShadowRay(Ray const& ray, float t_max) const {
 // Box
 ////////////////////////////////////////////////////////////////////////////////
 
-/// Ray-AABB intersection
-/// TODO: Switch to return a struct with bool hit, float tmin, float tmax if needed
-/// 
-#define FAST_MIN(a, b) ((a) < (b) ? (a) : (b))
-#define FAST_MAX(a, b) ((a) > (b) ? (a) : (b))
-
-inline bool hitAABB(Ray ray, const float* bounds) {
-    float b0 = bounds[0], b1 = bounds[1], b2 = bounds[2];
-    float b3 = bounds[3], b4 = bounds[4], b5 = bounds[5];
-
-    float invDirX = ray.invDir.x;
-    float invDirY = ray.invDir.y;
-    float invDirZ = ray.invDir.z;
-
-    float t1 = (b0 - ray.p.x) * invDirX;
-    float t2 = (b3 - ray.p.x) * invDirX;
-    float t3 = (b1 - ray.p.y) * invDirY;
-    float t4 = (b4 - ray.p.y) * invDirY;
-    float t5 = (b2 - ray.p.z) * invDirZ;
-    float t6 = (b5 - ray.p.z) * invDirZ;
-
-    float tminX = FAST_MIN(t1, t2);
-    float tmaxX = FAST_MAX(t1, t2);
-    float tminY = FAST_MIN(t3, t4);
-    float tmaxY = FAST_MAX(t3, t4);
-    float tminZ = FAST_MIN(t5, t6);
-    float tmaxZ = FAST_MAX(t5, t6);
-
-    float tmin = FAST_MAX(FAST_MAX(tminX, tminY), tminZ);
-    float tmax = FAST_MIN(FAST_MIN(tmaxX, tmaxY), tmaxZ);
-
-    return tmax >= tmin && tmax >= 0.0f;
+bool Box::IntersectRay(Ray const& r, float t_max) const {
+    Vec3f const* planes[2] = { &pmin, &pmax };
+    float tmin = -BIGFLOAT, tmax = BIGFLOAT;
+    for (int a = 0; a < 3; a++) {
+        tmin = FAST_MAX(tmin, (*planes[r.sign[a]])[a] * r.invDir[a] - r.pInvDir[a]);
+        tmax = FAST_MIN(tmax, (*planes[1 - r.sign[a]])[a] * r.invDir[a] - r.pInvDir[a]);
+    }
+
+    return tmax >= tmin && tmax >= 0.0f && tmin < t_max;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Plane
 ////////////////////////////////////////////////////////////////////////////////
 
-bool Plane::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const {
-    cyVec3f planeNorm(0.0f, 0.0f, 1.0f);
-
+bool Plane::IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide) const {
     //Exit early if ray parallel
     if (fabsf(ray.dir.z) < 1e-8f) return false;
 
     float t = -(ray.p.z / ray.dir.z);
 
-    if (t > 0.0002 && hInfo.z > t) {
-        hInfo.z = t;
-        hInfo.N = planeNorm;
-        hInfo.p = ray.p + (ray.dir * t);
-		hInfo.uvw = cyVec3f((hInfo.p.x + 1.0f) * 0.5f, (hInfo.p.y + 1.0f) * 0.5f, 0.0f);
+    if (t > 0.0002 && hit.z > t) {
+        cyVec3f p = ray.p + (ray.dir * t);
 
         // Check if the intersection point is within the bounds of the plane
-        if (hInfo.p.x < -1.0f || hInfo.p.x > 1.0f || hInfo.p.y < -1.0f || hInfo.p.y > 1.0f)
+        if (p.x < -1.0f || p.x > 1.0f || p.y < -1.0f || p.y > 1.0f)
             return false;
 
-        hInfo.front = (ray.dir.Dot(planeNorm) < 0);
-        if ((hInfo.front && (hitSide & HIT_FRONT)) || (!hInfo.front && (hitSide & HIT_BACK)))
+        bool front = ray.dir.z < 0;
+        if ((front && (hitSide & HIT_FRONT)) || (!front && (hitSide & HIT_BACK))) {
+            hit.z = t;
             return true;
+        }
     }
 
     return false;
 }
 
+void Plane::EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const {
+    cyVec3f planeNorm(0.0f, 0.0f, 1.0f);
+    hInfo.z = hit.z;
+    hInfo.N = planeNorm;
+    hInfo.p = ray.p + (ray.dir * hit.z);
+    hInfo.uvw = cyVec3f((hInfo.p.x + 1.0f) * 0.5f, (hInfo.p.y + 1.0f) * 0.5f, 0.0f);
+    hInfo.front = (ray.dir.Dot(planeNorm) < 0);
+}
+
 bool Plane::ShadowRay(Ray const& ray, float t_max) const {
     cyVec3f planeNorm(0.0f, 0.0f, 1.0f);
     float t = -(ray.p.z / ray.dir.z);
@@ -169,28 +176,208 @@ bool Plane::ShadowRay(Ray const& ray, float t_max) const {
 ////////////////////////////////////////////////////////////////////////////////
 // Triangle Mesh
 ////////////////////////////////////////////////////////////////////////////////
-bool TriObj::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const {
-    HitInfo temphit;
-    temphit.Init();
-
-    if (TraceBVHNode(ray, temphit, hitSide, bvh.GetRootNodeID()))
-    {
-		hInfo = temphit;
+bool TriObj::Load(char const* filename, BVHBuildParams const& bvhParams, TriangleLayout triLayout, bool deferBVH)
+{
+    if (!LoadFromFileObj(filename)) return false;
+    if (!HasNormals()) ComputeNormals();
+    ComputeBoundingBox();
+    faceMtl.clear();
+    if (deferBVH) {
+        deferredFile = filename;
+        deferredParams = bvhParams;
+        deferredLayout = triLayout;
+        bvhReady.store(false, std::memory_order_release);
         return true;
     }
+    BuildAccelerationStructure(bvhParams, triLayout, ComputeBVHCacheKey(filename, bvhParams));
+    return true;
+}
 
-    return false;
+/*
+* The first thread that needs a deferred BVH builds it while holding the lock, with one build thread per core
+* unless the mesh asks for fewer, and the threads that need it meanwhile block on the lock until it is done.
+*/
+void TriObj::EnsureBVH() const
+{
+    if (bvhReady.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(bvhBuildMutex);
+    if (bvhReady.load(std::memory_order_acquire)) return;
+
+    // Building the hierarchy changes how fast the mesh is queried, not what the queries return
+    TriObj* self = const_cast<TriObj*>(this);
+    self->BuildAccelerationStructure(deferredParams, deferredLayout, ComputeBVHCacheKey(deferredFile.c_str(), deferredParams));
+    printf("Built deferred BVH of \"%s\": %u BVH nodes, SAH cost %.2f%s\n", GetName(), GetBVHNodeCount(), GetBVHCost(), bvhCached ? " (cached)" : "");
+}
+
+// Returns false if the BVH is deferred and the ray misses the mesh bounds, otherwise makes sure the BVH is built
+bool TriObj::PrepareBVH(Ray const& ray, float t_max) const
+{
+    if (bvhReady.load(std::memory_order_acquire)) return true;
+    Vec3f const& bmin = GetBoundMin();
+    Vec3f const& bmax = GetBoundMax();
+    float bounds[6] = { bmin.x, bmin.y, bmin.z, bmax.x, bmax.y, bmax.z };
+    float tNear;
+    if (!hitAABB(ray, bounds, t_max, tNear)) return false;
+    EnsureBVH();
+    return true;
+}
+
+/*
+* Bakes meshes placed in the scene into this mesh. Vertices and normals are transformed to world space,
+* texture coordinates are copied, and every face keeps its material as an ID into the merged material list.
+*/
+bool TriObj::Merge(std::vector<MergeSource> const& sources, BVHBuildParams const& bvhParams, TriangleLayout triLayout)
+{
+    unsigned int numV = 0, numF = 0, numVN = 0, numVT = 0;
+    bool hasTex = false;
+    for (MergeSource const& src : sources) {
+        numV += src.mesh->NV();
+        numF += src.mesh->NF();
+        numVN += src.mesh->NVN();
+        numVT += src.mesh->HasTextureVertices() ? src.mesh->NVT() : 1;  // meshes without texture coordinates share one at the origin
+        hasTex |= src.mesh->HasTextureVertices();
+    }
+    if (numF == 0) return false;
+
+    SetNumVertex(numV);
+    SetNumFaces(numF, true, hasTex);
+    SetNumNormals(numVN);
+    if (hasTex) SetNumTexVerts(numVT);
+    faceMtl.resize(numF);
+
+    unsigned int baseV = 0, baseF = 0, baseVN = 0, baseVT = 0;
+    for (MergeSource const& src : sources) {
+        TriObj const& m = *src.mesh;
+        for (unsigned int i = 0; i < m.NV(); i++) V(baseV + i) = src.toWorld.TransformFrom(m.V(i));
+        for (unsigned int i = 0; i < m.NVN(); i++) VN(baseVN + i) = src.toWorld.NormalTransformFrom(m.VN(i)).GetNormalized();
+        if (hasTex) {
+            if (m.HasTextureVertices()) for (unsigned int i = 0; i < m.NVT(); i++) VT(baseVT + i) = m.VT(i);
+            else VT(baseVT).Set(0, 0, 0);
+        }
+
+        for (unsigned int i = 0; i < m.NF(); i++) {
+            for (int k = 0; k < 3; k++) {
+                F(baseF + i).v[k] = baseV + m.F(i).v[k];
+                FN(baseF + i).v[k] = baseVN + m.FN(i).v[k];
+                if (hasTex) FT(baseF + i).v[k] = baseVT + (m.HasTextureVertices() ? m.FT(i).v[k] : 0);
+            }
+            faceMtl[baseF + i] = src.mtlBase + (src.useMeshMtls ? m.GetFaceMaterial(i) : 0);
+        }
+
+        baseV += m.NV();
+        baseF += m.NF();
+        baseVN += m.NVN();
+        baseVT += m.HasTextureVertices() ? m.NVT() : 1;
+    }
+
+    ComputeBoundingBox();
+    BuildAccelerationStructure(bvhParams, triLayout);
+    return true;
+}
+
+int TriObj::GetFaceMaterial(unsigned int faceID) const
+{
+    if (!faceMtl.empty()) return faceMtl[faceID];
+    return NM() > 0 ? GetMaterialIndex(faceID) : 0;
+}
+
+/*
+* With quantized nodes, the full-float 8-wide nodes and the binary nodes are freed once the quantized layout
+* is built. The binary elements stay, every layout refers to them.
+*/
+void TriObj::BuildAccelerationStructure(BVHBuildParams const& bvhParams, TriangleLayout triLayout, uint64_t cacheKey)
+{
+    bvhCached = cacheKey != 0 && LoadBVHCache(cacheKey, NF(), bvhParams, bvh);
+    if (!bvhCached) {
+        if (bvhParams.spatialSplits) {
+            std::vector<Vec3f> faceVerts(3 * NF());
+            for (unsigned int i = 0; i < NF(); i++) {
+                TriFace const& face = F(i);
+                for (int k = 0; k < 3; k++) faceVerts[3 * i + k] = V(face.v[k]);
+            }
+            bvh.BuildSpatial(faceVerts, bvhParams);
+        }
+        else {
+            std::vector<Box> faceBounds(NF());
+            for (unsigned int i = 0; i < NF(); i++) {
+                TriFace const& face = F(i);
+                faceBounds[i] += V(face.v[0]);
+                faceBounds[i] += V(face.v[1]);
+                faceBounds[i] += V(face.v[2]);
+            }
+            bvh.Build(faceBounds, bvhParams);
+        }
+        if (cacheKey != 0) SaveBVHCache(cacheKey, bvh);
+    }
+
+    bvh4.Clear();
+    bvh8.Clear();
+    qbvh.Clear();
+    bvhWidth = bvhParams.width;
+    if (bvhWidth == 4) bvh4.Build(bvh);
+    else if (bvhWidth == 8) bvh8.Build(bvh);
+    else bvhWidth = 2;
+
+    if (bvhWidth == 8 && bvhParams.quantized && qbvh.Build(bvh8)) {
+        bvh8.Clear();
+        bvh.ReleaseNodes();
+    }
+
+    triangles.Clear();
+    if (triLayout == TRIANGLES_FAST && !bvh.IsEmpty()) triangles.Build(*this, bvh.GetElements(0), bvh.GetNumElements());
+    bvhReady.store(true, std::memory_order_release);
+}
+
+bool TriObj::IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide) const {
+    if (!PrepareBVH(ray, hit.z) || bvh.IsEmpty()) return false;
+    if (bvhWidth == 4) return TraceWideBVH(ray, hit, hitSide, bvh4);
+    if (bvhWidth == 8) return qbvh.IsEmpty() ? TraceWideBVH(ray, hit, hitSide, bvh8) : TraceWideBVH(ray, hit, hitSide, qbvh);
+    return TraceBVH(ray, hit, hitSide);
 }
 
 
 bool TriObj::ShadowRay(Ray const& ray, float t_max) const {
-    return TraceBVHNodeShadow(ray, t_max, bvh.GetRootNodeID());
+    unsigned int prim, neighborhood;
+    return ShadowRayOccluder(ray, t_max, prim, neighborhood);
+}
+
+/*
+* Any-hit query that reports the element slot of the blocking triangle. For the binary layout the
+* neighborhood is the parent of the leaf that held it, zero (the root) for the wide layouts.
+*/
+bool TriObj::ShadowRayOccluder(Ray const& ray, float t_max, unsigned int& prim, unsigned int& neighborhood) const {
+    if (!PrepareBVH(ray, t_max) || bvh.IsEmpty()) return false;
+    neighborhood = 0;
+    int slot;
+    if (bvhWidth == 4) slot = TraceWideBVHShadow(ray, t_max, bvh4);
+    else if (bvhWidth == 8) slot = qbvh.IsEmpty() ? TraceWideBVHShadow(ray, t_max, bvh8) : TraceWideBVHShadow(ray, t_max, qbvh);
+    else slot = bvh.FindAny(ray, t_max, bvh.GetRootNodeID(), neighborhood,
+        [&](unsigned int first, unsigned int count) { return IntersectLeafShadow(ray, first, count, t_max); });
+    if (slot < 0) return false;
+    prim = (unsigned int)slot;
+    return true;
+}
+
+bool TriObj::ShadowRayPrimitive(Ray const& ray, float t_max, unsigned int prim) const {
+    if (IsBVHDeferred()) return false;
+    if (!triangles.IsEmpty()) return triangles.IntersectShadow(ray, prim, t_max);
+    return IntersectTriangleShadow(ray, HIT_FRONT_AND_BACK, *bvh.GetElements(prim), t_max);
+}
+
+bool TriObj::ShadowRayNeighborhood(Ray const& ray, float t_max, unsigned int neighborhood, unsigned int& prim) const {
+    if (neighborhood == 0 || bvhWidth != 2 || IsBVHDeferred()) return false;
+    unsigned int parent;
+    int slot = bvh.FindAny(ray, t_max, neighborhood, parent,
+        [&](unsigned int first, unsigned int count) { return IntersectLeafShadow(ray, first, count, t_max); });
+    if (slot < 0) return false;
+    prim = (unsigned int)slot;
+    return true;
 }
 
 /*
 * Moller-Trumbore intersection algorithm
 */
-bool TriObj::IntersectTriangle(Ray const& ray, HitInfo& hInfo, int hitSide, unsigned int faceID, cyVec2f& baryCoords) const {
+bool TriObj::IntersectTriangle(Ray const& ray, HitRecord& hit, int hitSide, unsigned int faceID) const {
     TriFace const& face = F(faceID);
     const float epsilon = 0.002f;
 
@@ -223,10 +410,11 @@ bool TriObj::IntersectTriangle(Ray const& ray, HitInfo& hInfo, int hitSide, unsi
 
     float t = inv_det * edge2.Dot(s_cross_e1);
 
-    if (t <= epsilon || t >= hInfo.z) return false;
+    if (t <= epsilon || t >= hit.z) return false;
 
-    hInfo.z = t;
-    baryCoords.Set(u, v);
+    hit.z = t;
+    hit.primID = faceID;
+    hit.bary.Set(u, v);
     return true;
 }
 
@@ -262,114 +450,245 @@ bool TriObj::IntersectTriangleShadow(Ray const& ray, int hitside, unsigned int f
     if (t > epsilon && t < max) {
         return true;
     }
+
+    return false;
 }
 
 
-bool TriObj::TraceBVHNode(Ray const& ray, HitInfo& hInfo, int hitSide, unsigned int nodeID) const {
-    const float* bounds = bvh.GetNodeBounds(nodeID);
+/*
+* Intersects the triangles in element slots [first, first+count) of the hierarchy. Uses the SIMD leaf kernel
+* of the precomputed triangle buffer when there is one, otherwise goes through the mesh faces. Returns true if a closer hit was found.
+*/
+bool TriObj::IntersectLeaf(Ray const& ray, HitRecord& hit, int hitSide, unsigned int first, unsigned int count) const {
+    unsigned int const* elements = bvh.GetElements(first);
+    if (!triangles.IsEmpty()) {
+        int slot = triangles.IntersectClosest(ray, first, count, hit.z, hit.bary);
+        if (slot < 0) return false;
+        hit.primID = elements[slot - first];
+        return true;
+    }
 
-    if (!hitAABB(ray, bounds)) {
-        return false;
+    bool found = false;
+    for (unsigned int i = 0; i < count; i++) {
+        if (IntersectTriangle(ray, hit, hitSide, elements[i])) found = true;
     }
+    return found;
+}
 
-    // Check if this is a leaf node
-    if (bvh.IsLeafNode(nodeID)) {
-        bool hit = false;
-        unsigned int elementCount = bvh.GetNodeElementCount(nodeID);
-        unsigned int const* elements = bvh.GetNodeElements(nodeID);
-        int closestFace = INT_MAX;
-        cyVec2f baryCoords(0.0f, 0.0f);
-		HitInfo tempHit;
-        tempHit.Init();
-        cyVec2f tempBary;
-
-        // Test ray against each triangle in this leaf node
-        for (unsigned int i = 0; i < elementCount; i++) 
-        {
-            unsigned int triangleIndex = elements[i];
-
-            if (IntersectTriangle(ray, tempHit, hitSide, triangleIndex, tempBary)) 
-            {
-                hit = true;
-                if (tempHit.z >= hInfo.z) continue;
-				hInfo.z = tempHit.z;
-                closestFace = triangleIndex;
-                baryCoords = tempBary;
-            }
-        }
+/*
+* Returns the element slot of a triangle in slots [first, first+count) that blocks the ray, or -1
+*/
+int TriObj::IntersectLeafShadow(Ray const& ray, unsigned int first, unsigned int count, float t_max) const {
+    if (!triangles.IsEmpty()) return triangles.IntersectAny(ray, first, count, t_max);
 
-		if (!hit) return false;
+    unsigned int const* elements = bvh.GetElements(first);
+    for (unsigned int i = 0; i < count; i++) {
+        if (IntersectTriangleShadow(ray, HIT_FRONT_AND_BACK, elements[i], t_max)) return (int)(first + i);
+    }
+    return -1;
+}
 
-        TriFace const& textureFace = FT(closestFace);
-		TriFace const& normalFace = FN(closestFace);
-		float u = baryCoords.x;
-		float v = baryCoords.y;
-		float w = 1.0f - u - v;
+/*
+* Closest hit traversal of the binary hierarchy. Uses an explicit stack, descends into the nearer
+* child first and skips any subtree whose entry distance is beyond the closest hit found so far.
+* Only the closest face and its barycentric coordinates are tracked, in the hit record.
+* Nodes are read directly from the depth-first layout, the first child always follows its parent.
+*/
+bool TriObj::TraceBVH(Ray const& ray, HitRecord& hit, int hitSide) const {
+    float tNear;
+    if (!hitAABB(ray, bvh.GetNode(bvh.GetRootNodeID()).bounds, hit.z, tNear)) return false;
+    return TraverseBVH(ray, hit, hitSide, bvh.GetRootNodeID());
+}
 
-        cyVec3f uvw = (vt[textureFace.v[0]] * w) + 
-                      (vt[textureFace.v[1]] * u) + 
-                      (vt[textureFace.v[2]] * v);
+/*
+* Closest hit traversal of the subtree under startNode, whose box the ray is known to enter.
+* Updates the hit record for every closer hit and returns true if there was one.
+*/
+bool TriObj::TraverseBVH(Ray const& ray, HitRecord& hit, int hitSide, unsigned int startNode) const {
+    struct StackEntry { unsigned int node; float t; };
+    StackEntry stack[BVH_MAX_DEPTH];
+    int stackSize = 0;
+
+    bool found = false;
+    unsigned int nodeID = startNode;
+    for (;;) {
+        LinearBVHNode const& node = bvh.GetNode(nodeID);
+        if (node.count > 0) {
+            if (IntersectLeaf(ray, hit, hitSide, node.offset, node.count)) found = true;
+        }
+        else {
+            unsigned int child1 = nodeID + 1;
+            unsigned int child2 = node.offset;
+            float t1, t2;
+            bool hit1 = hitAABB(ray, bvh.GetNode(child1).bounds, hit.z, t1);
+            bool hit2 = hitAABB(ray, bvh.GetNode(child2).bounds, hit.z, t2);
+
+            if (hit1 && hit2) {
+                if (t2 < t1) {
+                    std::swap(child1, child2);
+                    std::swap(t1, t2);
+                }
+                stack[stackSize++] = { child2, t2 };
+                nodeID = child1;
+                continue;
+            }
+            if (hit1) { nodeID = child1; continue; }
+            if (hit2) { nodeID = child2; continue; }
+        }
 
-        hInfo.N = (w * vn[normalFace.v[0]] +
-            u * vn[normalFace.v[1]] +
-            v * vn[normalFace.v[2]]).GetNormalized();
+        // Pop the next subtree that can still contain a closer hit
+        while (stackSize > 0 && stack[stackSize - 1].t > hit.z) stackSize--;
+        if (stackSize == 0) break;
+        nodeID = stack[--stackSize].node;
+    }
 
-        hInfo.p = ray.p + ray.dir * hInfo.z;
-        hInfo.uvw = uvw;
-        hInfo.z = tempHit.z;
-        hInfo.front = ray.dir.Dot(hInfo.N) < 0;
+    return found;
+}
 
-        return true;
+/*
+* Traces the packet through the binary BVH together. Each node box is tested for all lanes at once against
+* their own closest hit; a subtree entered by a single lane is finished with that lane's single ray traversal.
+* Wide BVH layouts trace the lanes one by one.
+*/
+int TriObj::IntersectPacket(RayPacket const& packet, HitRecord* hits, int hitSide) const {
+    if (IsBVHDeferred()) return Object::IntersectPacket(packet, hits, hitSide);    // the lanes build the BVH if they enter the mesh
+    if (bvh.IsEmpty()) return 0;
+    if (bvhWidth != 2 || CountLanes(packet.active) < 2) return Object::IntersectPacket(packet, hits, hitSide);
+
+    alignas(16) float t[RAY_PACKET_SIZE];
+    Ray rays[RAY_PACKET_SIZE];
+    for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+        t[lane] = hits[lane].z;
+        if (packet.active & (1 << lane)) rays[lane] = packet.Get(lane);
     }
-    else {
-        unsigned int child1, child2;
-        bvh.GetChildNodes(nodeID, child1, child2);
-
-        HitInfo hitInfo1, hitInfo2;
-        bool hit1 = TraceBVHNode(ray, hitInfo1, hitSide, child1);
-        bool hit2 = TraceBVHNode(ray, hitInfo2, hitSide, child2);
-        if(hitInfo1.z < hitInfo2.z) {
-            hInfo = hitInfo1;
-            return hit1;
-        } else {
-            hInfo = hitInfo2;
-            return hit2;
-		}
+
+    unsigned int stack[BVH_MAX_DEPTH + 1];
+    int stackSize = 0;
+    stack[stackSize++] = bvh.GetRootNodeID();
+
+    int hitMask = 0;
+    while (stackSize > 0) {
+        unsigned int nodeID = stack[--stackSize];
+        LinearBVHNode const& node = bvh.GetNode(nodeID);
+        int mask = IntersectPacketAABB(packet, node.bounds, t, packet.active);
+        if (mask == 0) continue;
+
+        if (CountLanes(mask) == 1) {
+            // The packet has diverged here, the one ray left continues alone
+            int lane = FirstLane(mask);
+            if (TraverseBVH(rays[lane], hits[lane], hitSide, nodeID)) hitMask |= mask;
+            t[lane] = hits[lane].z;
+        }
+        else if (node.count > 0) {
+            for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) {
+                if (!(mask & (1 << lane))) continue;
+                if (IntersectLeaf(rays[lane], hits[lane], hitSide, node.offset, node.count)) hitMask |= 1 << lane;
+                t[lane] = hits[lane].z;
+            }
+        }
+        else {
+            // Visit the child on the near side of the split plane first, as seen by the first ray that reached the node
+            unsigned int child1 = nodeID + 1;
+            unsigned int child2 = node.offset;
+            if (rays[FirstLane(mask)].dir[node.axis] < 0.0f) std::swap(child1, child2);
+            stack[stackSize++] = child2;
+            stack[stackSize++] = child1;
+        }
     }
+
+    return hitMask;
 }
 
-bool TriObj::TraceBVHNodeShadow(Ray const& ray, float t_max, unsigned int nodeID) const {
-    float const* bounds = bvh.GetNodeBounds(nodeID);
+/*
+* Interpolates the shading attributes of the face in the hit record at its barycentric coordinates
+*/
+void TriObj::EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const {
+    unsigned int faceID = hit.primID;
+    TriFace const& textureFace = FT(faceID);
+    TriFace const& normalFace = FN(faceID);
+    float u = hit.bary.x;
+    float v = hit.bary.y;
+    float w = 1.0f - u - v;
+
+    hInfo.uvw = (vt[textureFace.v[0]] * w) +
+                (vt[textureFace.v[1]] * u) +
+                (vt[textureFace.v[2]] * v);
+
+    hInfo.N = (w * vn[normalFace.v[0]] +
+        u * vn[normalFace.v[1]] +
+        v * vn[normalFace.v[2]]).GetNormalized();
+
+    hInfo.z = hit.z;
+    hInfo.p = ray.p + ray.dir * hit.z;
+    hInfo.front = ray.dir.Dot(hInfo.N) < 0;
+    hInfo.mtlID = GetFaceMaterial(faceID);
+}
 
-    if (!hitAABB(ray, bounds)) {
-        return false;
-    }
-    // Check if this is a leaf node
-    if (bvh.IsLeafNode(nodeID)) {
-        unsigned int elementCount = bvh.GetNodeElementCount(nodeID);
-        unsigned int const* elements = bvh.GetNodeElements(nodeID);
-
-        // Test ray against each triangle in this leaf node
-        for (unsigned int i = 0; i < elementCount; i++)
-        {
-            unsigned int triangleIndex = elements[i];
-            if (IntersectTriangleShadow(ray, HIT_FRONT_AND_BACK, triangleIndex, t_max))
-            {
-                return true;
+/*
+* Closest hit traversal of the 4-wide, 8-wide or quantized 8-wide layout. All child boxes of a node are tested
+* together, leaves are intersected right away and interior children are visited near to far.
+*/
+template <typename WideLayout>
+bool TriObj::TraceWideBVH(Ray const& ray, HitRecord& hit, int hitSide, WideLayout const& wide) const {
+    const int N = WideLayout::width;
+    struct StackEntry { unsigned int node; float t; };
+    StackEntry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0.0f };
+
+    bool found = false;
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        if (entry.t > hit.z) continue;
+
+        alignas(32) float tNear[N];
+        unsigned int child[N], count[N];
+        int mask = wide.IntersectChildren(entry.node, ray, hit.z, tNear, child, count);
+
+        int order[N];
+        int numInner = 0;
+        for (int i = 0; mask >> i; i++) {
+            if (!(mask & (1 << i))) continue;
+            if (count[i] > 0) {
+                if (IntersectLeaf(ray, hit, hitSide, child[i], count[i])) found = true;
+            }
+            else {
+                // Sort far to near so that the nearest child is popped first
+                int j = numInner++;
+                while (j > 0 && tNear[order[j - 1]] < tNear[i]) { order[j] = order[j - 1]; j--; }
+                order[j] = i;
             }
         }
-        return false;
-    }
-    else {
-        unsigned int child1, child2;
-        bvh.GetChildNodes(nodeID, child1, child2);
-        bool hit1 = TraceBVHNodeShadow(ray, t_max, child1);
-        if (hit1) return true;
-        bool hit2 = TraceBVHNodeShadow(ray, t_max, child2);
-        return hit2;
+        for (int j = 0; j < numInner; j++) stack[stackSize++] = { child[order[j]], tNear[order[j]] };
     }
+
+    return found;
 }
 
+template <typename WideLayout>
+int TriObj::TraceWideBVHShadow(Ray const& ray, float t_max, WideLayout const& wide) const {
+    const int N = WideLayout::width;
+    unsigned int stack[BVH_MAX_DEPTH * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        alignas(32) float tNear[N];
+        unsigned int child[N], count[N];
+        int mask = wide.IntersectChildren(stack[--stackSize], ray, t_max, tNear, child, count);
+
+        for (int i = 0; mask >> i; i++) {
+            if (!(mask & (1 << i))) continue;
+            if (count[i] > 0) {
+                int slot = IntersectLeafShadow(ray, child[i], count[i], t_max);
+                if (slot >= 0) return slot;
+            }
+            else stack[stackSize++] = child[i];
+        }
+    }
+
+    return -1;
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 // Lights
@@ -18,9 +18,16 @@
 #ifndef _OBJECTS_H_INCLUDED_
 #define _OBJECTS_H_INCLUDED_
 
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
 #include "scene.h"
 #include "cyTriMesh.h"
-#include "cyBVH.h"
+#include "bvh.h"
+#include "wideBVH.h"
+#include "compressedBVH.h"
+#include "triBuffer.h"
 
 
 //-------------------------------------------------------------------------------
@@ -28,7 +35,9 @@
 class Sphere : public Object
 {
 public:
-    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override;
+    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override { return IntersectRayWithRecord(ray, hInfo, hitSide); }
+    bool IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide = HIT_FRONT) const override;
+    void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const override;
 	bool ShadowRay(Ray const& ray, float t_max) const override;
     Box  GetBoundBox() const override { return Box(-1, -1, -1, 1, 1, 1); }
     void ViewportDisplay(Material const* mtl) const override;
@@ -39,7 +48,9 @@ public:
 class Plane : public Object
 {
 public:
-    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override;
+    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override { return IntersectRayWithRecord(ray, hInfo, hitSide); }
+    bool IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide = HIT_FRONT) const override;
+    void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const override;
     bool ShadowRay(Ray const& ray, float t_max) const override;
     Box  GetBoundBox() const override { return Box(-1, -1, 0, 1, 1, 0); }
     void ViewportDisplay(const Material* mtl) const override;
@@ -52,26 +63,75 @@ extern Plane thePlane;
 class TriObj : public Object, public TriMesh
 {
 public:
-    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override;
+    bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override { return IntersectRayWithRecord(ray, hInfo, hitSide); }
+    bool IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide = HIT_FRONT) const override;
+    void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const override;
     bool ShadowRay(Ray const& ray, float t_max) const override;
+    bool ShadowRayOccluder(Ray const& ray, float t_max, unsigned int& prim, unsigned int& neighborhood) const override;
+    bool ShadowRayPrimitive(Ray const& ray, float t_max, unsigned int prim) const override;
+    bool ShadowRayNeighborhood(Ray const& ray, float t_max, unsigned int neighborhood, unsigned int& prim) const override;
+    int  IntersectPacket(RayPacket const& packet, HitRecord* hits, int hitSide = HIT_FRONT) const override;
     Box  GetBoundBox() const override { return Box(GetBoundMin(), GetBoundMax()); }
     void ViewportDisplay(const Material* mtl) const override;
 
-    bool Load(char const* filename)
+    // With deferBVH, only the mesh and its bounding box are loaded, and the BVH is built by the first ray that enters the box
+    bool Load(char const* filename, BVHBuildParams const& bvhParams = BVHBuildParams(), TriangleLayout triLayout = TRIANGLES_COMPACT, bool deferBVH = false);
+
+    // A mesh placed in the scene, baked into a merged mesh by Merge
+    struct MergeSource
     {
-        if (!LoadFromFileObj(filename)) return false;
-        if (!HasNormals()) ComputeNormals();
-        ComputeBoundingBox();
-        bvh.SetMesh(this, 4);
-        return true;
-    }
+        TriObj const*  mesh;
+        Transformation toWorld;     // object to world transformation of the node
+        int            mtlBase;     // ID of the first material of this mesh in the merged material list
+        bool           useMeshMtls; // offset the per-face materials of the mesh by mtlBase, instead of using mtlBase for all faces
+    };
+    bool Merge(std::vector<MergeSource> const& sources, BVHBuildParams const& bvhParams = BVHBuildParams(), TriangleLayout triLayout = TRIANGLES_COMPACT);
+
+    // Returns the material ID of the face, from the merge or the OBJ materials
+    int GetFaceMaterial(unsigned int faceID) const;
+
+    float GetBVHCost() const { return bvh.GetSAHCost(); }
+    unsigned int GetBVHNodeCount() const { return bvh.GetNumNodes(); }
+    unsigned int GetBVHReferenceCount() const { return bvh.GetNumElements(); }
+    BVHBuildParams const& GetBVHParams() const { return bvh.GetBuildParams(); }
+    int GetBVHWidth() const { return bvhWidth; }
+    bool IsBVHQuantized() const { return !qbvh.IsEmpty(); }
+    size_t GetBVHNodeMemory() const { return bvh.GetNodeMemoryUsage() + bvh4.GetMemoryUsage() + bvh8.GetMemoryUsage() + qbvh.GetMemoryUsage(); }
+    TriangleLayout GetTriangleLayout() const { return triangles.IsEmpty() ? TRIANGLES_COMPACT : TRIANGLES_FAST; }
+    size_t GetTriangleBufferSize() const { return triangles.GetMemoryUsage(); }
+    bool IsBVHCached() const { return bvhCached; }
+    bool IsBVHDeferred() const { return !bvhReady.load(std::memory_order_acquire); }
+
+    // Builds a deferred BVH right away, does nothing if it is built. Threads that need the BVH meanwhile wait for the build.
+    void EnsureBVH() const;
+
+    // Builds the binary hierarchy, or maps it from the BVH cache when a key is given and a matching file exists,
+    // then derives the traversal layout and the triangle buffer from it
+    void BuildAccelerationStructure(BVHBuildParams const& bvhParams, TriangleLayout triLayout, uint64_t cacheKey = 0);
 
 private:
-    BVHTriMesh bvh;
-    bool IntersectTriangle(Ray const& ray, HitInfo& hInfo, int hitSide, unsigned int faceID, cyVec2f& baryCoords) const;
+    SAHBVH bvh;
+    WideBVH<4> bvh4;
+    WideBVH<8> bvh8;
+    CompressedBVH qbvh;         // replaces bvh8 and the binary nodes when built with quantized nodes
+    int bvhWidth = 2;
+    TriangleBuffer triangles;   // empty unless loaded with TRIANGLES_FAST
+    std::vector<int> faceMtl;   // per-face material IDs of merged meshes, empty otherwise
+    bool bvhCached = false;     // the hierarchy is mapped from the BVH cache
+    mutable std::atomic<bool> bvhReady{ true };     // false until the deferred build is done
+    mutable std::mutex bvhBuildMutex;               // held by the thread running the deferred build
+    std::string deferredFile;                       // the deferred build maps the BVH cache entry of this file
+    BVHBuildParams deferredParams;
+    TriangleLayout deferredLayout = TRIANGLES_COMPACT;
+    bool PrepareBVH(Ray const& ray, float t_max) const;
+    bool IntersectTriangle(Ray const& ray, HitRecord& hit, int hitSide, unsigned int faceID) const;
     bool IntersectTriangleShadow(Ray const& ray, int hitside, unsigned int faceID, float max) const;
-    bool TraceBVHNode(Ray const& ray, HitInfo& hInfo, int hitSide, unsigned int nodeID) const;
-	bool TraceBVHNodeShadow(Ray const& ray, float t_max, unsigned int nodeID) const;
+    bool IntersectLeaf(Ray const& ray, HitRecord& hit, int hitSide, unsigned int first, unsigned int count) const;
+    int  IntersectLeafShadow(Ray const& ray, unsigned int first, unsigned int count, float t_max) const;
+    bool TraceBVH(Ray const& ray, HitRecord& hit, int hitSide) const;
+    bool TraverseBVH(Ray const& ray, HitRecord& hit, int hitSide, unsigned int startNode) const;
+    template <typename WideLayout> bool TraceWideBVH(Ray const& ray, HitRecord& hit, int hitSide, WideLayout const& wide) const;
+    template <typename WideLayout> int  TraceWideBVHShadow(Ray const& ray, float t_max, WideLayout const& wide) const;
 };
 
 //-------------------------------------------------------------------------------
@@ -0,0 +1,19 @@
+///
+/// \file       rayPacket.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Packet fallback for objects without a packet traversal of their own
+///
+
+#include "rayPacket.h"
+
+int Object::IntersectPacket(RayPacket const& packet, HitRecord* hits, int hitSide) const
+{
+	int mask = 0;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		if ((packet.active & (1 << lane)) && IntersectRecord(packet.Get(lane), hits[lane], hitSide)) mask |= 1 << lane;
+	}
+	return mask;
+}
@@ -0,0 +1,110 @@
+#pragma once
+///
+/// \file       rayPacket.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Packets of coherent rays traced through the hierarchies together
+///
+/// Primary rays of neighboring pixels start at the camera and point in nearly the same
+/// direction, so they visit nearly the same BVH nodes. A packet keeps up to 8 of them in
+/// structure-of-arrays form and tests them against a node box in one go; traversal only
+/// continues with single rays once a subtree is hit by a single ray of the packet.
+///
+
+#include "scene.h"
+#include "bvh.h"
+#include "simd.h"
+
+#define RAY_PACKET_SIZE 8
+
+struct alignas(32) RayPacket
+{
+	float px[RAY_PACKET_SIZE], py[RAY_PACKET_SIZE], pz[RAY_PACKET_SIZE];					// origins
+	float dx[RAY_PACKET_SIZE], dy[RAY_PACKET_SIZE], dz[RAY_PACKET_SIZE];					// directions
+	float invDx[RAY_PACKET_SIZE], invDy[RAY_PACKET_SIZE], invDz[RAY_PACKET_SIZE];		// reciprocal directions
+	float pInvDx[RAY_PACKET_SIZE], pInvDy[RAY_PACKET_SIZE], pInvDz[RAY_PACKET_SIZE];	// origins times reciprocal directions
+	int   active = 0;	// bit i is set if lane i holds a ray
+
+	void Set(int lane, Ray const& ray)
+	{
+		px[lane] = ray.p.x; py[lane] = ray.p.y; pz[lane] = ray.p.z;
+		dx[lane] = ray.dir.x; dy[lane] = ray.dir.y; dz[lane] = ray.dir.z;
+		invDx[lane] = ray.invDir.x; invDy[lane] = ray.invDir.y; invDz[lane] = ray.invDir.z;
+		pInvDx[lane] = ray.pInvDir.x; pInvDy[lane] = ray.pInvDir.y; pInvDz[lane] = ray.pInvDir.z;
+		active |= 1 << lane;
+	}
+
+	Ray Get(int lane) const
+	{
+		Ray ray;
+		ray.p.Set(px[lane], py[lane], pz[lane]);
+		ray.dir.Set(dx[lane], dy[lane], dz[lane]);
+		ray.invDir.Set(invDx[lane], invDy[lane], invDz[lane]);
+		ray.pInvDir.Set(pInvDx[lane], pInvDy[lane], pInvDz[lane]);
+		for (int a = 0; a < 3; a++) ray.sign[a] = ray.invDir[a] < 0.0f;
+		return ray;
+	}
+};
+
+#if SIMD_X86
+// SafeReciprocal of four direction components
+inline __m128 SafeReciprocal4(__m128 d)
+{
+	__m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 tiny = _mm_cmplt_ps(_mm_andnot_ps(signBit, d), _mm_set1_ps(1e-20f));
+	__m128 big = _mm_or_ps(_mm_and_ps(d, signBit), _mm_set1_ps(1e20f));
+	return _mm_or_ps(_mm_and_ps(tiny, big), _mm_andnot_ps(tiny, _mm_div_ps(_mm_set1_ps(1.0f), d)));
+}
+#endif
+
+inline int CountLanes(int mask)
+{
+	int n = 0;
+	for (; mask; mask &= mask - 1) n++;
+	return n;
+}
+
+inline int FirstLane(int mask)
+{
+	int lane = 0;
+	while (!(mask & (1 << lane))) lane++;
+	return lane;
+}
+
+// Returns the mask of lanes in laneMask whose ray enters the box before the lane's tMax.
+// Computes the same plane distances as hitAABB, so a lane hits exactly the boxes its single ray would.
+// The lanes may differ in direction signs, so the near and far plane are sorted with min/max here.
+inline int IntersectPacketAABB(RayPacket const& packet, float const* bounds, float const* tMax, int laneMask)
+{
+#if SIMD_X86
+	int mask = 0;
+	for (int h = 0; h < RAY_PACKET_SIZE; h += 4)
+	{
+		if (!((laneMask >> h) & 0xF)) continue;
+		__m128 ox = _mm_load_ps(packet.pInvDx + h), oy = _mm_load_ps(packet.pInvDy + h), oz = _mm_load_ps(packet.pInvDz + h);
+		__m128 ix = _mm_load_ps(packet.invDx + h), iy = _mm_load_ps(packet.invDy + h), iz = _mm_load_ps(packet.invDz + h);
+		__m128 t1 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[0]), ix), ox);
+		__m128 t2 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[3]), ix), ox);
+		__m128 t3 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[1]), iy), oy);
+		__m128 t4 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[4]), iy), oy);
+		__m128 t5 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[2]), iz), oz);
+		__m128 t6 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bounds[5]), iz), oz);
+
+		// _mm_min_ps(a,b) is a<b?a:b and _mm_max_ps(a,b) is a>b?a:b, the same as FAST_MIN and FAST_MAX
+		__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1, t2), _mm_min_ps(t3, t4)), _mm_min_ps(t5, t6));
+		__m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1, t2), _mm_max_ps(t3, t4)), _mm_max_ps(t5, t6));
+		__m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_and_ps(_mm_cmpge_ps(tmax, _mm_setzero_ps()), _mm_cmple_ps(tmin, _mm_loadu_ps(tMax + h))));
+		mask |= _mm_movemask_ps(hit) << h;
+	}
+	return mask & laneMask;
+#else
+	int mask = 0;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		float tNear;
+		if ((laneMask & (1 << lane)) && hitAABB(packet.Get(lane), bounds, tMax[lane], tNear)) mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+///
+/// \file       raySort.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Sort keys that bring rays with similar origins and directions together
+///
+/// Secondary and photon rays leave their hit points in every direction, so consecutive rays
+/// visit unrelated parts of the hierarchies and most node fetches miss the cache. Sorting a
+/// batch of them by direction octant first and by the Morton code of their origin second
+/// makes neighbors in the batch start close to each other and walk the tree the same way.
+///
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "scene.h"
+
+// Spreads the lower 10 bits of v apart, leaving two zero bits between each
+inline uint32_t ExpandBits10(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// 30-bit Morton code of p, quantized to 1024 steps per axis within bounds
+inline uint32_t MortonCode(Vec3f const& p, Box const& bounds)
+{
+	uint32_t code = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = bounds.pmax[axis] - bounds.pmin[axis];
+		float t = extent > 0.0f ? (p[axis] - bounds.pmin[axis]) / extent : 0.0f;
+		uint32_t q = (uint32_t)std::min(std::max(t * 1024.0f, 0.0f), 1023.0f);
+		code |= ExpandBits10(q) << (2 - axis);
+	}
+	return code;
+}
+
+// Direction octant in bits 30-32, Morton code of the origin below
+inline uint64_t RaySortKey(Ray const& ray, Box const& bounds)
+{
+	uint64_t octant = (ray.dir.x < 0.0f ? 1 : 0) | (ray.dir.y < 0.0f ? 2 : 0) | (ray.dir.z < 0.0f ? 4 : 0);
+	return (octant << 30) | MortonCode(ray.p, bounds);
+}
+
+// Fills keys with the sort key and index of each of count rays, sorted by key. getRay(i) returns ray i.
+// Origins are quantized within their own bounds, so a large object far away does not squeeze them into a few cells.
+template <typename GetRay>
+void SortRays(size_t count, GetRay const& getRay, std::vector<std::pair<uint64_t, uint32_t>>& keys)
+{
+	Box bounds;
+	for (size_t i = 0; i < count; i++) bounds += getRay(i).p;
+
+	keys.resize(count);
+	for (size_t i = 0; i < count; i++) keys[i] = { RaySortKey(getRay(i), bounds), (uint32_t)i };
+	std::sort(keys.begin(), keys.end());
+}
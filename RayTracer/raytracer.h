@@ -8,8 +8,13 @@
 /// \brief PImplementation of Renderer Class
 
 #include <vector>
+#include <mutex>
 #include "renderer.h"
 #include "rng.h"
+#include "sceneBVH.h"
+#include "lightBVH.h"
+#include "threadPool.h"
+#include "tileScheduler.h"
 
 class RayTracer : public Renderer
 {
@@ -21,34 +26,53 @@ class RayTracer : public Renderer
 		const int minSamples = 32;
 
 		const int numPhotons = 100000;
+		const int photonBatchSize = 4096;	// photons emitted together when photon rays are sorted
 
 		RayTracer() {}
-		~RayTracer() {}
+		~RayTracer();
+		bool LoadScene(char const* sceneFilename) override;
+		// Refits the scene hierarchy to moved nodes instead of reloading, BeginRender calls it before every render.
+		// Must not run while rendering. Returns false if it had to rebuild.
+		bool RefitScene() { scene.rootNode.ComputeChildBoundBox(); return sceneBVH.Refit(scene.rootNode); }
+		// Renders on the worker threads of the pool and returns right away. A render that is still running is stopped first.
 		void BeginRender() override;
+		// Cancels the render, waits for the tiles in progress and returns once every worker is idle
 		void StopRender() override;
 
 		//Ray Tracing Methods
 		bool TraceRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT_AND_BACK) const override;
 		bool TraceShadowRay(Ray const& ray, float t_max, int hitSide = HIT_FRONT_AND_BACK) const override;
-		bool TraverseTree(const Ray& ray, const Node* node, HitInfo& hitInfo, int hitSide) const;
-		bool TraverseTreeShadow(const Ray& ray, const Node* node, float t_max) const;
+		// Shadow ray toward a light, tries what blocked the calling thread's last ray toward that light first
+		bool TraceShadowRay(Ray const& ray, float t_max, Light const* light) const;
 		void CreateCam2Wrld();
-		Color SendRay(int i, Ray ray, cyVec2f scrPos, RNG rng);
+		// Color of a camera ray that was already traced, hitAny tells whether hit holds a hit
+		Color ShadePrimary(int i, Ray const& ray, HitInfo& hit, bool hitAny, cyVec2f scrPos, RNG rng);
 
 		//Photon Map Methods
 		void GeneratePhotons(PhotonMap* map, PhotonMap* caustics);
 		bool TracePhoton(Ray const& ray, HitInfo& hInfo, Color& c, PhotonMap* map, PhotonMap* cMap, DirSampler::Info si);
+		// Stores a photon that hit a surface and samples the ray it continues along, returns false if it was absorbed
+		bool ScatterPhoton(Ray const& ray, HitInfo const& hInfo, Color const& c, DirSampler::Info& si, PhotonMap* map, PhotonMap* cMap, RNG& rng, Ray& photonRay, Color& photonColor);
+		// Photon rays, and the secondary rays of the wavefront renderer, are collected in batches and sorted by
+		// direction octant and origin before tracing, so rays traced one after the other share hierarchy nodes
+		void SetSortRays(bool sort) { sortRays = sort; }
+
 		PhotonMap const* GetPhotonMap() const override { return map; }
 		PhotonMap const* GetCausticsMap() const override { return caustics;}
+		LightBVH const* GetLightBVH() const override { return lightBVH.IsEmpty() ? nullptr : &lightBVH; }
 
 
-	private:
+	protected:
 		const int tileSize = 32;
+		const int minTileSize = 8;		// stolen tiles are split in half down to this size, see TileScheduler
+		const int blockWidth = 4;		// pixels of a block share a primary ray packet, blockWidth*blockHeight <= RAY_PACKET_SIZE
+		const int blockHeight = 2;
+		const int packetMinRays = 3;	// below this many unconverged pixels, a block traces single rays
 		std::vector<float> albedoBuffer{};
 		std::vector<float> normalBuffer{};
-		std::atomic<int> nextTile{ 0 };
-		PhotonMap* map;
-		PhotonMap* caustics;
+		TileScheduler tiles;
+		PhotonMap* map = nullptr;
+		PhotonMap* caustics = nullptr;
 		float tValues[71] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
 								   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
 								   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
@@ -57,5 +81,32 @@ class RayTracer : public Renderer
 								   2.000, 2.000, 2.000, 2.000, 2.000, 2.000, 2.000, 2.000, 2.000, 2.000,
 								   1.994, 1.994, 1.994, 1.994, 1.994, 1.994, 1.994, 1.994, 1.994, 1.994 };
 		cyMatrix4f cam2Wrld{};
-		void RunThread(std::atomic<int>& nextTile, int totalTiles, int tilesX, int tilesY);
+		cyVec3f camX, camY, camZ;		// camera axes in world space
+		float imgPlaneWidth = 0.0f, imgPlaneHeight = 0.0f;	// image plane size at the focal distance
+		bool sortRays = false;
+		SceneBVH sceneBVH;
+		LightBVH lightBVH;
+		OcclusionStats occlusionStats;	// occluder cache counts of all threads, reported when the render is done
+		std::mutex occlusionStatsMutex;
+		void FlushOcclusionStats();
+		void GeneratePhotonBatches(std::vector<Light*> const& photonLights, RNG& rng, PhotonMap* map, PhotonMap* caustics);
+		// Renders tiles of the scheduler until none are left or the render is cancelled, cancellation is checked between tiles
+		void RunThread(int worker, CancelToken const& cancel);
+		// Prints the render statistics, then saves and denoises the image. Runs once, after the last tile.
+		void FinishRender();
+		// Renders the pixels [x0,x1)x[y0,y1) of a tile to completion
+		virtual void RenderTile(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton);
+		void RenderBlock(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton);
+		// Image plane position and lens offset of sample i of a pixel, given the random offsets of the pixel
+		void SamplePixel(int x, int y, int i, float randomOffset, float randomOffsetY, HaltonSeq<128> const* halton, float& pixX, float& pixY, float& lensU, float& lensV) const;
+		void GeneratePrimaryRays(RayPacket& packet, float const* pixX, float const* pixY, float const* lensU, float const* lensV, int active) const;
+		int  TracePacket(RayPacket const& packet, HitInfo* hInfo, int hitSide = HIT_FRONT) const;
+		// Adaptive sampling test after sample i of a pixel, with the sums of its sample colors and their squares
+		bool IsConverged(Color const& sumColor, Color const& sumColorSquared, int i) const;
+		void StorePixel(int x, int y, Color const& sumColor, int totalSamples);
+		bool TraceLights(Ray const& ray, HitInfo& hInfo) const;
+
+		// Declared last so the workers are joined before the members they use are destroyed
+		ThreadPool threadPool;
+		ThreadPool::Job renderJob;
 };
\ No newline at end of file
@@ -28,6 +28,7 @@
 //-------------------------------------------------------------------------------
 
 class PhotonMap;
+class LightBVH;
 class Renderer;
 
 //-------------------------------------------------------------------------------
@@ -147,6 +148,7 @@ public:
         hInfo.GN.Normalize();
         ray = r;
         ray.dir.Normalize();
+        ray.Precompute();
     }
 
     void SetPixelSample(int i) { pSample = i; }
@@ -184,6 +186,8 @@ public:
     // Traces a shadow ray and returns the visibility
     virtual float TraceShadowRay(Ray   const& ray, float t_max = BIGFLOAT) const { return 1.0f; }
     virtual float TraceShadowRay(Vec3f const& dir, float t_max = BIGFLOAT) const { return TraceShadowRay(Ray(P(), dir), t_max); }
+    // Shadow ray toward the given light, lets the renderer start from what blocked the previous rays toward it
+    virtual float TraceShadowRay(Ray   const& ray, float t_max, Light const* light) const { return TraceShadowRay(ray, t_max); }
 
     // Traces a ray and returns the shaded color at the hit point.
     // It also sets t to the distance to the hit point, if a front is found.
@@ -213,7 +217,7 @@ protected:
     Camera      camera;
     RenderImage renderImage;
     std::string sceneFile;
-    bool isRendering = false;
+    std::atomic<bool> isRendering{ false };
 
 public:
     Scene& GetScene() { return scene; }
@@ -235,6 +239,7 @@ public:
 
     virtual PhotonMap const* GetPhotonMap() const { return nullptr; }
     virtual PhotonMap const* GetCausticsMap() const { return nullptr; }
+    virtual LightBVH  const* GetLightBVH() const { return nullptr; }  // null unless lights are picked by importance
 };
 
 //-------------------------------------------------------------------------------
@@ -23,6 +23,7 @@
 #include <vector>
 #include <atomic>
 #include <string>
+#include <cmath>
 
 #include "cyVector.h"
 #include "cyMatrix.h"
@@ -42,6 +43,7 @@ class SamplerInfo;
 class ShadeInfo;
 class RNG;
 class Loader;
+struct RayPacket;
 
 template <class T> class ItemList;
 
@@ -52,13 +54,25 @@ typedef ItemList<Texture>  TextureFileList;
 
 //-------------------------------------------------------------------------------
 
+// Reciprocal of a direction component. Components within 1e-20 of zero get a large finite reciprocal
+// of the same sign instead of infinity, so the slab terms of a ray never compute 0 * inf.
+inline float SafeReciprocal(float d) { return fabsf(d) < 1e-20f ? (std::signbit(d) ? -1e20f : 1e20f) : 1.0f / d; }
+
 struct Ray
 {
-    Vec3f p, dir, invDir;
+    Vec3f p, dir;
+    Vec3f invDir;   // reciprocal direction, see SafeReciprocal
+    Vec3f pInvDir;  // p * invDir, the ray crosses the plane x = b at t = b * invDir.x - pInvDir.x
+    int   sign[3];  // 1 on the axes where invDir is negative, where the near plane of a box is its maximum
 
     Ray() = default;
-    Ray(Vec3f const& _p, Vec3f const& _dir) : p(_p), dir(_dir) {
-        invDir = { 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z };
+    Ray(Vec3f const& _p, Vec3f const& _dir) : p(_p), dir(_dir) { Precompute(); }
+
+    // Computes the terms derived from p and dir, needed again after either is changed
+    void Precompute() {
+        invDir.Set(SafeReciprocal(dir.x), SafeReciprocal(dir.y), SafeReciprocal(dir.z));
+        pInvDir = p * invDir;
+        for (int a = 0; a < 3; a++) sign[a] = invDir[a] < 0.0f;
     }
 };
 
@@ -89,6 +103,19 @@ struct HitInfo
     void Init() { z = BIGFLOAT; node = nullptr; uvw.Set(0.5f); duvw[0].Zero(); duvw[1].Zero(); mtlID = 0; front = true; light = false; }
 };
 
+// The closest hit found so far while tracing a ray. Traversal keeps only this record;
+// the surface attributes of the winning hit are computed once, by Object::EvaluateHit.
+struct HitRecord
+{
+    float        z;         // the distance from the ray center to the hit point
+    unsigned int primID;    // primitive of the object that was hit, such as the face of a mesh
+    unsigned int instID;    // scene instance that was hit
+    Vec2f        bary;      // barycentric coordinates on the primitive, for primitives that have them
+
+    HitRecord() { Init(); }
+    void Init() { z = BIGFLOAT; primID = 0; instID = 0; bary.Set(0.0f, 0.0f); }
+};
+
 //-------------------------------------------------------------------------------
 
 class Box
@@ -210,9 +237,27 @@ class Object : public ItemBase
 public:
     virtual bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const = 0;
     virtual bool ShadowRay(Ray const& ray, float t_max) const { return false; }
+
+    // Closest hit query that only fills the hit record, for a hit closer than hit.z. EvaluateHit then computes the
+    // surface attributes of that record into an initialized hInfo, given the same ray and hitSide. Objects without
+    // a record of their own keep nothing and run IntersectRay again; their closest hit does not depend on hit.z.
+    virtual bool IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide = HIT_FRONT) const;
+    virtual void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const { IntersectRay(ray, hInfo, hitSide); }
+
+    // Shadow queries for an occluder cache. ShadowRayOccluder also returns the primitive that blocked the ray and a
+    // node of the object hierarchy around it; the other two test only that primitive or only that node's subtree.
+    // Objects without primitives of their own report the whole object and have no neighborhood.
+    virtual bool ShadowRayOccluder(Ray const& ray, float t_max, unsigned int& prim, unsigned int& neighborhood) const { prim = neighborhood = 0; return ShadowRay(ray, t_max); }
+    virtual bool ShadowRayPrimitive(Ray const& ray, float t_max, unsigned int prim) const { return ShadowRay(ray, t_max); }
+    virtual bool ShadowRayNeighborhood(Ray const& ray, float t_max, unsigned int neighborhood, unsigned int& prim) const { return false; }
+    virtual int  IntersectPacket(RayPacket const& packet, HitRecord* hits, int hitSide = HIT_FRONT) const;  // returns the mask of lanes that hit, tests the lanes one by one unless overridden
     virtual Box  GetBoundBox() const = 0;
     virtual void ViewportDisplay(Material const* mtl) const {}    // used for OpenGL display
     virtual void Load(Loader const& loader) {}
+
+protected:
+    // IntersectRay of objects that implement IntersectRecord and EvaluateHit
+    bool IntersectRayWithRecord(Ray const& ray, HitInfo& hInfo, int hitSide) const;
 };
 
 //-------------------------------------------------------------------------------
@@ -416,6 +461,7 @@ public:
     Node* GetChild(int i) { return childNodes[i]; }
     void        AppendChild(Node* node) { childNodes.push_back(node); }
     void        DeleteAllChildNodes() { for (Node* c : childNodes) { c->DeleteAllChildNodes(); delete c; } childNodes.clear(); }
+    void        DeleteChildNodes(int first, int count) { for (int i = first; i < first + count; i++) delete childNodes[i]; childNodes.erase(childNodes.begin() + first, childNodes.begin() + first + count); }
 
     // Bounding Box
     Box const& ComputeChildBoundBox()
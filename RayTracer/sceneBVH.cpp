@@ -0,0 +1,359 @@
+///
+/// \file       sceneBVH.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the top-level hierarchy defined in sceneBVH.h
+///
+
+#include <algorithm>
+#include <atomic>
+#include "sceneBVH.h"
+#include "rayPacket.h"
+
+// Source of the build IDs that invalidate occluder cache entries of older builds
+static std::atomic<unsigned int> lastBuildID{ 0 };
+
+/**
+ * Collects every node that holds an object and builds a binary hierarchy over
+ * their world space bounds, so scene traversal no longer visits every node.
+ *
+ * @param root  Root node of the loaded scene.
+ */
+void SceneBVH::Build(Node const& root)
+{
+	Clear();
+	buildID = ++lastBuildID;
+
+	Matrix34f identity;
+	identity.SetIdentity();
+	CollectInstances(&root, identity, instances);
+	if (instances.empty()) return;
+
+	std::vector<Box> bounds;
+	GetInstanceBounds(bounds);
+
+	BVHBuildParams params;
+	params.maxLeafSize = maxLeafSize;
+	bvh.Build(bounds, params);
+	buildCost = bvh.GetSAHCost();
+}
+
+/**
+ * Refits the hierarchy to the current node transformations. Rigid motion of a node only
+ * changes its world transformation, so the objects (and mesh BVHs) below it are untouched.
+ *
+ * @param root  Root node of the scene the hierarchy was built for.
+ */
+bool SceneBVH::Refit(Node const& root)
+{
+	std::vector<Instance> moved;
+	moved.reserve(instances.size());
+	Matrix34f identity;
+	identity.SetIdentity();
+	CollectInstances(&root, identity, moved);
+
+	bool sameNodes = moved.size() == instances.size();
+	for (size_t i = 0; sameNodes && i < moved.size(); i++) sameNodes = moved[i].node == instances[i].node;
+	if (!sameNodes || bvh.IsEmpty()) {
+		Build(root);
+		return false;
+	}
+
+	instances.swap(moved);
+	std::vector<Box> bounds;
+	GetInstanceBounds(bounds);
+	float cost = bvh.Refit(bounds);
+	if (cost > buildCost * rebuildThreshold) {
+		Build(root);
+		return false;
+	}
+	return true;
+}
+
+void SceneBVH::CollectInstances(Node const* node, Matrix34f const& parentTM, std::vector<Instance>& list) const
+{
+	Matrix34f tm = parentTM * node->GetTransform();
+
+	Object const* obj = node->GetNodeObj();
+	if (obj)
+	{
+		Box local = obj->GetBoundBox();
+		if (!local.IsEmpty())
+		{
+			Instance inst;
+			inst.node = node;
+			inst.toWorld.Transform(tm);
+			for (int j = 0; j < 8; j++) inst.bound += inst.toWorld.TransformFrom(local.Corner(j));
+			list.push_back(inst);
+		}
+	}
+
+	for (int i = 0; i < node->GetNumChild(); i++)
+		CollectInstances(node->GetChild(i), tm, list);
+}
+
+void SceneBVH::GetInstanceBounds(std::vector<Box>& bounds) const
+{
+	bounds.resize(instances.size());
+	for (size_t i = 0; i < instances.size(); i++) bounds[i] = instances[i].bound;
+}
+
+// t is preserved by the transformation, so the object culls against the closest hit and updates the record in place
+bool SceneBVH::IntersectInstance(unsigned int instID, Ray const& ray, HitRecord& hit, int hitSide) const
+{
+	Instance const& inst = instances[instID];
+	if (!inst.node->GetNodeObj()->IntersectRecord(inst.toWorld.ToNodeCoords(ray), hit, hitSide)) return false;
+	hit.instID = instID;
+	return true;
+}
+
+/**
+ * Evaluates the hit the same way the instance found it: the ray is transformed to the
+ * object again, and the object computes the attributes that are then moved to world space.
+ */
+void SceneBVH::EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const
+{
+	Instance const& inst = instances[hit.instID];
+	HitInfo localHit;
+	inst.node->GetNodeObj()->EvaluateHit(inst.toWorld.ToNodeCoords(ray), hit, hitSide, localHit);
+	inst.toWorld.FromNodeCoords(localHit);
+	localHit.node = inst.node;
+	hInfo = localHit;
+}
+
+/**
+ * Closest hit traversal with an explicit stack, nearer child first, skipping subtrees
+ * that start beyond the closest hit found so far. Traversal only keeps the hit record,
+ * the attributes of the closest hit are evaluated once at the end.
+ */
+bool SceneBVH::IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const
+{
+	if (bvh.IsEmpty()) return false;
+
+	HitRecord hit;
+	hit.z = hInfo.z;
+	float tNear;
+	if (!hitAABB(ray, bvh.GetNode(bvh.GetRootNodeID()).bounds, hit.z, tNear)) return false;
+	if (!Traverse(ray, hit, hitSide, bvh.GetRootNodeID())) return false;
+	EvaluateHit(ray, hit, hitSide, hInfo);
+	return true;
+}
+
+bool SceneBVH::Traverse(Ray const& ray, HitRecord& hit, int hitSide, unsigned int startNode) const
+{
+	struct StackEntry { unsigned int node; float t; };
+	StackEntry stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	unsigned int nodeID = startNode;
+	bool found = false;
+	for (;;)
+	{
+		LinearBVHNode const& node = bvh.GetNode(nodeID);
+		if (node.count > 0)
+		{
+			unsigned int const* elements = bvh.GetElements(node.offset);
+			for (unsigned int i = 0; i < node.count; i++)
+				if (IntersectInstance(elements[i], ray, hit, hitSide)) found = true;
+		}
+		else
+		{
+			unsigned int child1 = nodeID + 1;
+			unsigned int child2 = node.offset;
+			float t1, t2;
+			bool hit1 = hitAABB(ray, bvh.GetNode(child1).bounds, hit.z, t1);
+			bool hit2 = hitAABB(ray, bvh.GetNode(child2).bounds, hit.z, t2);
+
+			if (hit1 && hit2)
+			{
+				if (t2 < t1)
+				{
+					std::swap(child1, child2);
+					std::swap(t1, t2);
+				}
+				stack[stackSize++] = { child2, t2 };
+				nodeID = child1;
+				continue;
+			}
+			if (hit1) { nodeID = child1; continue; }
+			if (hit2) { nodeID = child2; continue; }
+		}
+
+		while (stackSize > 0 && stack[stackSize - 1].t > hit.z) stackSize--;
+		if (stackSize == 0) break;
+		nodeID = stack[--stackSize].node;
+	}
+
+	return found;
+}
+
+int SceneBVH::IntersectInstancePacket(unsigned int instID, RayPacket const& packet, int laneMask, HitRecord* hits, int hitSide) const
+{
+	Instance const& inst = instances[instID];
+	RayPacket localPacket;
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		if (laneMask & (1 << lane)) localPacket.Set(lane, inst.toWorld.ToNodeCoords(packet.Get(lane)));
+	}
+
+	int hitMask = inst.node->GetNodeObj()->IntersectPacket(localPacket, hits, hitSide);
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		if (hitMask & (1 << lane)) hits[lane].instID = instID;
+	}
+	return hitMask;
+}
+
+/**
+ * Traverses the hierarchy with all lanes of the packet at once. Each node box is tested
+ * against every lane that is still active, and instances receive the lanes that reached
+ * them as a packet. Once a single lane is left in a subtree, it is finished as a single ray.
+ * The lanes keep hit records, and the lanes that hit are evaluated once the packet is done.
+ */
+int SceneBVH::IntersectPacket(RayPacket const& packet, HitInfo* hInfo, int hitSide) const
+{
+	if (bvh.IsEmpty() || packet.active == 0) return 0;
+
+	alignas(16) float t[RAY_PACKET_SIZE];
+	HitRecord hits[RAY_PACKET_SIZE];
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) t[lane] = hits[lane].z = hInfo[lane].z;
+
+	unsigned int stack[BVH_MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = bvh.GetRootNodeID();
+
+	int hitMask = 0;
+	while (stackSize > 0)
+	{
+		unsigned int nodeID = stack[--stackSize];
+		LinearBVHNode const& node = bvh.GetNode(nodeID);
+		int mask = IntersectPacketAABB(packet, node.bounds, t, packet.active);
+		if (mask == 0) continue;
+
+		if (CountLanes(mask) == 1)
+		{
+			int lane = FirstLane(mask);
+			if (Traverse(packet.Get(lane), hits[lane], hitSide, nodeID)) hitMask |= mask;
+			t[lane] = hits[lane].z;
+		}
+		else if (node.count > 0)
+		{
+			unsigned int const* elements = bvh.GetElements(node.offset);
+			for (unsigned int i = 0; i < node.count; i++)
+				hitMask |= IntersectInstancePacket(elements[i], packet, mask, hits, hitSide);
+			for (int lane = 0; lane < RAY_PACKET_SIZE; lane++) t[lane] = hits[lane].z;
+		}
+		else
+		{
+			// Near child first, judged by the direction of the first lane on the split axis
+			unsigned int child1 = nodeID + 1;
+			unsigned int child2 = node.offset;
+			float dir = node.axis == 0 ? packet.dx[FirstLane(mask)] : node.axis == 1 ? packet.dy[FirstLane(mask)] : packet.dz[FirstLane(mask)];
+			if (dir < 0.0f) std::swap(child1, child2);
+			stack[stackSize++] = child2;
+			stack[stackSize++] = child1;
+		}
+	}
+
+	for (int lane = 0; lane < RAY_PACKET_SIZE; lane++)
+	{
+		if (hitMask & (1 << lane)) EvaluateHit(packet.Get(lane), hits[lane], hitSide, hInfo[lane]);
+	}
+	return hitMask;
+}
+
+bool SceneBVH::ShadowRay(Ray const& ray, float t_max) const
+{
+	return TraverseShadow(ray, t_max, nullptr) >= 0;
+}
+
+/**
+ * Shadow rays toward the same light from nearby shading points, and the many samples of one
+ * soft shadow, tend to be blocked by the same primitive. Testing it before anything else
+ * answers most blocked rays with one intersection, and its neighborhood catches the rays
+ * that just miss it. Unblocked rays still need the full traversal to prove it.
+ *
+ * @param occluder  Cache entry of the light, kept when no new occluder is found.
+ * @param stats     Counts to add this ray to.
+ */
+bool SceneBVH::ShadowRay(Ray const& ray, float t_max, Occluder& occluder, OcclusionStats& stats) const
+{
+	stats.rays++;
+	if (occluder.buildID == buildID && occluder.instance >= 0 && occluder.instance < (int)instances.size())
+	{
+		Instance const& inst = instances[occluder.instance];
+		Object const* obj = inst.node->GetNodeObj();
+		Ray localRay = inst.toWorld.ToNodeCoords(ray);
+		if (obj->ShadowRayPrimitive(localRay, t_max, occluder.prim))
+		{
+			stats.primitiveHits++;
+			return true;
+		}
+		if (obj->ShadowRayNeighborhood(localRay, t_max, occluder.neighborhood, occluder.prim))
+		{
+			stats.neighborhoodHits++;
+			return true;
+		}
+	}
+
+	Occluder found;
+	found.buildID = buildID;
+	found.instance = TraverseShadow(ray, t_max, &found);
+	if (found.instance < 0) return false;
+
+	occluder = found;
+	stats.traversalHits++;
+	return true;
+}
+
+int SceneBVH::TraverseShadow(Ray const& ray, float t_max, Occluder* occluder) const
+{
+	if (bvh.IsEmpty()) return -1;
+
+	unsigned int stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	unsigned int nodeID = bvh.GetRootNodeID();
+	float tNear;
+	if (!hitAABB(ray, bvh.GetNode(nodeID).bounds, t_max, tNear)) return -1;
+
+	for (;;)
+	{
+		LinearBVHNode const& node = bvh.GetNode(nodeID);
+		if (node.count > 0)
+		{
+			unsigned int const* elements = bvh.GetElements(node.offset);
+			for (unsigned int i = 0; i < node.count; i++)
+			{
+				Instance const& inst = instances[elements[i]];
+				Object const* obj = inst.node->GetNodeObj();
+				Ray localRay = inst.toWorld.ToNodeCoords(ray);
+				bool blocked = occluder ? obj->ShadowRayOccluder(localRay, t_max, occluder->prim, occluder->neighborhood) : obj->ShadowRay(localRay, t_max);
+				if (blocked) return (int)elements[i];
+			}
+		}
+		else
+		{
+			unsigned int child1 = nodeID + 1;
+			unsigned int child2 = node.offset;
+			float t1, t2;
+			bool hit1 = hitAABB(ray, bvh.GetNode(child1).bounds, t_max, t1);
+			bool hit2 = hitAABB(ray, bvh.GetNode(child2).bounds, t_max, t2);
+
+			if (hit1 && hit2)
+			{
+				stack[stackSize++] = child2;
+				nodeID = child1;
+				continue;
+			}
+			if (hit1) { nodeID = child1; continue; }
+			if (hit2) { nodeID = child2; continue; }
+		}
+
+		if (stackSize == 0) break;
+		nodeID = stack[--stackSize];
+	}
+
+	return -1;
+}
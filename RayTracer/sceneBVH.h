@@ -0,0 +1,90 @@
+#pragma once
+///
+/// \file       sceneBVH.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Top-level bounding volume hierarchy built over the scene nodes
+///
+
+#include <vector>
+#include <cstdint>
+#include "scene.h"
+#include "bvh.h"
+
+// The primitive that last blocked a shadow ray toward a light, tried first by the next shadow ray toward it
+struct Occluder
+{
+	unsigned int buildID = 0;		// hierarchy build the entry belongs to, entries of other builds are ignored
+	int          instance = -1;		// scene instance that holds the primitive, -1 if there is none
+	unsigned int prim = 0;			// primitive of the object, as reported by Object::ShadowRayOccluder
+	unsigned int neighborhood = 0;	// node of the object hierarchy around the primitive, zero if there is none
+};
+
+// How the shadow rays that went through an occluder cache were answered
+struct OcclusionStats
+{
+	uint64_t rays = 0;
+	uint64_t primitiveHits = 0;		// blocked by the cached primitive
+	uint64_t neighborhoodHits = 0;	// blocked by a primitive in the cached neighborhood
+	uint64_t traversalHits = 0;		// blocked, found by a full traversal
+
+	uint64_t Blocked() const { return primitiveHits + neighborhoodHits + traversalHits; }
+};
+
+class SceneBVH
+{
+public:
+	const unsigned int maxLeafSize = 2;
+	const float rebuildThreshold = 1.5f;	// Refit rebuilds when the SAH cost grows past this factor of the cost after the last build
+
+	// Flattens the node hierarchy under root into instances and builds the hierarchy over their world space bounds
+	void Build(Node const& root);
+	void Clear() { instances.clear(); bvh.Clear(); buildCost = 0.0f; }
+
+	// Picks up changed node transformations without rebuilding. Instances get new world transformations and bounds,
+	// and the tree bounds are refit bottom-up. Rebuilds instead if the set of object nodes changed or the refit tree
+	// is too much worse than the last build. Returns true if the tree was refit, false if it was rebuilt.
+	bool Refit(Node const& root);
+
+	bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide) const;
+	bool ShadowRay(Ray const& ray, float t_max) const;
+
+	// Shadow ray that first tries the primitive in the occluder entry, then the hierarchy neighborhood around it,
+	// and only then traverses the whole scene. The entry is updated whenever a new occluder is found.
+	bool ShadowRay(Ray const& ray, float t_max, Occluder& occluder, OcclusionStats& stats) const;
+
+	// Closest hits of the active lanes of the packet, returns the mask of lanes that hit something
+	int  IntersectPacket(RayPacket const& packet, HitInfo* hInfo, int hitSide) const;
+
+	int   NumInstances() const { return (int)instances.size(); }
+	float GetSAHCost() const { return bvh.GetSAHCost(); }
+	unsigned int GetBuildID() const { return buildID; }
+
+private:
+	// A node that holds an object. The object (for meshes, its own BVH) forms the bottom level,
+	// and the transformations of every node from the root down are folded into one matrix.
+	struct Instance
+	{
+		Node const* node;
+		Transformation toWorld;	// object to world transformation
+		Box bound;				// world space bounding box
+	};
+
+	std::vector<Instance> instances;	// in scene order, the hierarchy elements index this list
+	SAHBVH bvh;
+	float buildCost = 0.0f;
+	unsigned int buildID = 0;	// unique per build, a refit keeps the instances and their objects so it keeps the ID
+
+	void CollectInstances(Node const* node, Matrix34f const& parentTM, std::vector<Instance>& list) const;
+	void GetInstanceBounds(std::vector<Box>& bounds) const;
+	bool IntersectInstance(unsigned int instID, Ray const& ray, HitRecord& hit, int hitSide) const;
+	int  IntersectInstancePacket(unsigned int instID, RayPacket const& packet, int laneMask, HitRecord* hits, int hitSide) const;
+	bool Traverse(Ray const& ray, HitRecord& hit, int hitSide, unsigned int startNode) const;
+
+	// Fills hInfo with the surface attributes of the hit record, in world space
+	void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const;
+
+	// Any-hit traversal, returns the blocking instance or -1. With occluder given, records the primitive and neighborhood.
+	int  TraverseShadow(Ray const& ray, float t_max, Occluder* occluder) const;
+};
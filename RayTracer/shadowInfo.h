@@ -13,12 +13,14 @@ public:
 
 	RayTracer* renderer;
 	float TraceShadowRay(Ray   const& ray, float t_max = BIGFLOAT) const override;
+	float TraceShadowRay(Ray   const& ray, float t_max, Light const* light) const override;
 	Color TraceSecondaryRay(Ray const& ray, float& dist, bool reflection) const override;
 	bool CanBounce() const override;
 	bool CanMCBounce() const override; 
 	float GetHaltonPhi(int index) const override;
 	float GetHaltonTheta(int index) const override;
 	Renderer* GetRenderer() const override { return renderer;  }
+	void SetBounce(int b) { bounceC = b; }
 
 protected:
 	int bounceC = 0;
@@ -0,0 +1,59 @@
+#pragma once
+///
+/// \file       simd.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      SIMD intrinsics and runtime CPU feature detection
+///
+/// SSE is always available on x86/x64 builds. Functions using AVX or AVX2 are marked
+/// with SIMD_TARGET_AVX/SIMD_TARGET_AVX2 and must only be called after checking GetCPUFeatures().
+///
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_AVX  __attribute__((target("avx")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+struct CPUFeatures
+{
+	bool avx = false;
+	bool avx2 = false;	// also implies FMA
+
+	CPUFeatures()
+	{
+#if SIMD_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool cpuAVX = (info[2] & (1 << 28)) != 0;
+		bool cpuFMA = (info[2] & (1 << 12)) != 0;
+		avx = osxsave && cpuAVX && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		avx2 = avx && cpuFMA && (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		avx = __builtin_cpu_supports("avx");
+		avx2 = avx && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#endif
+	}
+};
+
+// Returns the features of the CPU we are running on, detected once on first use
+inline CPUFeatures const& GetCPUFeatures()
+{
+	static CPUFeatures features;
+	return features;
+}
@@ -0,0 +1,285 @@
+///
+/// \file       sphereCloud.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the sphere set defined in sphereCloud.h
+///
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include "sphereCloud.h"
+
+// The arrays are padded by this many entries so the last group of a SIMD test can always be loaded
+#define SPHERECLOUD_PAD 7
+
+void SphereCloud::Build(std::vector<Vec3f> const& centers, std::vector<float> const& radii, std::vector<int> const& mtlIDs, BVHBuildParams const& params)
+{
+	count = (unsigned int)centers.size();
+	bound.Init();
+
+	std::vector<Box> boxes(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		Vec3f r(radii[i], radii[i], radii[i]);
+		boxes[i] = Box(centers[i] - r, centers[i] + r);
+		bound += boxes[i];
+	}
+	bvh.Build(boxes, params);
+
+	// Store the spheres in the order the leaves reference them, so every leaf is one contiguous run of slots
+	for (int a = 0; a < 3; a++) center[a].assign(count + SPHERECLOUD_PAD, 0.0f);
+	radius.assign(count + SPHERECLOUD_PAD, 0.0f);
+	mtlID.assign(count, 0);
+	unsigned int const* order = bvh.GetElements(0);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int s = order[i];
+		for (int a = 0; a < 3; a++) center[a][i] = centers[s][a];
+		radius[i] = radii[s];
+		if (!mtlIDs.empty()) mtlID[i] = mtlIDs[s];
+	}
+}
+
+bool SphereCloud::IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide) const
+{
+	if (bvh.IsEmpty()) return false;
+
+	struct StackEntry { unsigned int node; float t; };
+	StackEntry stack[BVH_MAX_DEPTH];
+	int stackSize = 0;
+
+	float t = hit.z;
+	int closest = -1;
+
+	unsigned int nodeID = bvh.GetRootNodeID();
+	float tNear;
+	if (!hitAABB(ray, bvh.GetNode(nodeID).bounds, t, tNear)) return false;
+
+	for (;;)
+	{
+		LinearBVHNode const& node = bvh.GetNode(nodeID);
+		if (node.count > 0)
+		{
+			int slot = IntersectLeaf(ray, hitSide, node.offset, node.count, t);
+			if (slot >= 0) closest = slot;
+		}
+		else
+		{
+			unsigned int child1 = nodeID + 1;
+			unsigned int child2 = node.offset;
+			float t1, t2;
+			bool hit1 = hitAABB(ray, bvh.GetNode(child1).bounds, t, t1);
+			bool hit2 = hitAABB(ray, bvh.GetNode(child2).bounds, t, t2);
+
+			if (hit1 && hit2)
+			{
+				if (t2 < t1)
+				{
+					std::swap(child1, child2);
+					std::swap(t1, t2);
+				}
+				stack[stackSize++] = { child2, t2 };
+				nodeID = child1;
+				continue;
+			}
+			if (hit1) { nodeID = child1; continue; }
+			if (hit2) { nodeID = child2; continue; }
+		}
+
+		// Pop the next subtree that can still contain a closer hit
+		while (stackSize > 0 && stack[stackSize - 1].t > t) stackSize--;
+		if (stackSize == 0) break;
+		nodeID = stack[--stackSize].node;
+	}
+
+	if (closest < 0) return false;
+
+	hit.z = t;
+	hit.primID = (unsigned int)closest;
+	return true;
+}
+
+// A front hit enters the sphere and a back hit leaves it, so the side follows from the normal
+void SphereCloud::EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const
+{
+	unsigned int slot = hit.primID;
+	Vec3f c(center[0][slot], center[1][slot], center[2][slot]);
+	hInfo.z = hit.z;
+	hInfo.p = ray.p + ray.dir * hit.z;
+	hInfo.N = (hInfo.p - c).GetNormalized();
+	float tu = atan2f(hInfo.N.y, hInfo.N.x) / (2 * (float)M_PI) + 0.5f;
+	float tv = asinf(std::min(std::max(hInfo.N.z, -1.0f), 1.0f)) / (float)M_PI + 0.5f;
+	hInfo.uvw.Set(tu, tv, 0.0f);
+	hInfo.front = ray.dir.Dot(hInfo.N) < 0;
+	hInfo.mtlID = mtlID[slot];
+}
+
+bool SphereCloud::ShadowRay(Ray const& ray, float t_max) const
+{
+	unsigned int prim, neighborhood;
+	return ShadowRayOccluder(ray, t_max, prim, neighborhood);
+}
+
+// The primitive is the slot of the blocking sphere, the neighborhood the parent of its leaf
+bool SphereCloud::ShadowRayOccluder(Ray const& ray, float t_max, unsigned int& prim, unsigned int& neighborhood) const
+{
+	if (bvh.IsEmpty()) return false;
+	neighborhood = 0;
+	int slot = bvh.FindAny(ray, t_max, bvh.GetRootNodeID(), neighborhood,
+		[&](unsigned int first, unsigned int n) { return IntersectLeafShadow(ray, first, n, t_max); });
+	if (slot < 0) return false;
+	prim = (unsigned int)slot;
+	return true;
+}
+
+bool SphereCloud::ShadowRayPrimitive(Ray const& ray, float t_max, unsigned int prim) const
+{
+	return prim < count && IntersectLeafShadow(ray, prim, 1, t_max) >= 0;
+}
+
+bool SphereCloud::ShadowRayNeighborhood(Ray const& ray, float t_max, unsigned int neighborhood, unsigned int& prim) const
+{
+	if (neighborhood == 0) return false;
+	unsigned int parent;
+	int slot = bvh.FindAny(ray, t_max, neighborhood, parent,
+		[&](unsigned int first, unsigned int n) { return IntersectLeafShadow(ray, first, n, t_max); });
+	if (slot < 0) return false;
+	prim = (unsigned int)slot;
+	return true;
+}
+
+bool SphereCloud::PickRoot(float t1, float t2, int hitSide, float& t)
+{
+	const float eps = 0.002f;
+	if (t1 > eps && (hitSide & HIT_FRONT))
+	{
+		if (t1 < t) { t = t1; return true; }
+	}
+	else if (t2 >= eps && (hitSide & HIT_BACK))
+	{
+		if (t2 < t) { t = t2; return true; }
+	}
+	return false;
+}
+
+bool SphereCloud::Solve(Ray const& ray, unsigned int slot, float a, float& t1, float& t2) const
+{
+	Vec3f oc = ray.p - Vec3f(center[0][slot], center[1][slot], center[2][slot]);
+	float b = 2.0f * ray.dir.Dot(oc);
+	float c = oc.Dot(oc) - radius[slot] * radius[slot];
+	float discriminant = b * b - 4 * a * c;
+	if (discriminant < 0) return false;
+
+	float sqrt_disc = sqrtf(discriminant);
+	float twoA = 2 * a;
+	t1 = (-b - sqrt_disc) / twoA;
+	t2 = (-b + sqrt_disc) / twoA;
+	return true;
+}
+
+int SphereCloud::IntersectLeaf(Ray const& ray, int hitSide, unsigned int first, unsigned int n, float& t) const
+{
+	const float a = ray.dir.Dot(ray.dir);
+	int closest = -1;
+#if SIMD_X86
+	const int width = (n > 4 && GetCPUFeatures().avx) ? 8 : 4;
+	alignas(32) float t1[8], t2[8];
+	for (unsigned int i = 0; i < n; i += width)
+	{
+		const int lanes = std::min(width, (int)(n - i));
+		int mask = (width == 8) ? Solve8(ray, first + i, lanes, a, t1, t2) : Solve4(ray, first + i, lanes, a, t1, t2);
+		for (int k = 0; mask; k++, mask >>= 1)
+		{
+			if ((mask & 1) && PickRoot(t1[k], t2[k], hitSide, t)) closest = first + i + k;
+		}
+	}
+#else
+	for (unsigned int i = first; i < first + n; i++)
+	{
+		float t1, t2;
+		if (Solve(ray, i, a, t1, t2) && PickRoot(t1, t2, hitSide, t)) closest = i;
+	}
+#endif
+	return closest;
+}
+
+int SphereCloud::IntersectLeafShadow(Ray const& ray, unsigned int first, unsigned int n, float t_max) const
+{
+	const float a = ray.dir.Dot(ray.dir);
+	auto blocks = [t_max](float t1, float t2) { return (t1 > 0.01f && t1 < t_max) || (t2 > 0.01f && t2 < t_max); };
+#if SIMD_X86
+	const int width = (n > 4 && GetCPUFeatures().avx) ? 8 : 4;
+	alignas(32) float t1[8], t2[8];
+	for (unsigned int i = 0; i < n; i += width)
+	{
+		const int lanes = std::min(width, (int)(n - i));
+		int mask = (width == 8) ? Solve8(ray, first + i, lanes, a, t1, t2) : Solve4(ray, first + i, lanes, a, t1, t2);
+		for (int k = 0; mask; k++, mask >>= 1)
+		{
+			if ((mask & 1) && blocks(t1[k], t2[k])) return first + i + k;
+		}
+	}
+#else
+	for (unsigned int i = first; i < first + n; i++)
+	{
+		float t1, t2;
+		if (Solve(ray, i, a, t1, t2) && blocks(t1, t2)) return i;
+	}
+#endif
+	return -1;
+}
+
+#if SIMD_X86
+
+/**
+ * Solves the quadratic for 4 spheres at once, with the operations of the scalar Solve in
+ * the same order so both find the same roots.
+ *
+ * @param slot   First of the 4 slots to test.
+ * @param lanes  Number of slots that belong to the leaf, the rest are masked off.
+ */
+int SphereCloud::Solve4(Ray const& ray, unsigned int slot, int lanes, float a, float* t1, float* t2) const
+{
+	__m128 ox = _mm_sub_ps(_mm_set1_ps(ray.p.x), _mm_loadu_ps(&center[0][slot]));
+	__m128 oy = _mm_sub_ps(_mm_set1_ps(ray.p.y), _mm_loadu_ps(&center[1][slot]));
+	__m128 oz = _mm_sub_ps(_mm_set1_ps(ray.p.z), _mm_loadu_ps(&center[2][slot]));
+	__m128 r = _mm_loadu_ps(&radius[slot]);
+
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(ray.dir.x), ox), _mm_mul_ps(_mm_set1_ps(ray.dir.y), oy)), _mm_mul_ps(_mm_set1_ps(ray.dir.z), oz));
+	__m128 b = _mm_mul_ps(_mm_set1_ps(2.0f), dot);
+	__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)), _mm_mul_ps(r, r));
+	__m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_set1_ps(4 * a), c));
+	__m128 valid = _mm_cmpge_ps(disc, _mm_setzero_ps());
+
+	__m128 sqrtDisc = _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps()));
+	__m128 twoA = _mm_set1_ps(2 * a);
+	__m128 negB = _mm_sub_ps(_mm_setzero_ps(), b);
+	_mm_storeu_ps(t1, _mm_div_ps(_mm_sub_ps(negB, sqrtDisc), twoA));
+	_mm_storeu_ps(t2, _mm_div_ps(_mm_add_ps(negB, sqrtDisc), twoA));
+	return _mm_movemask_ps(valid) & ((1 << lanes) - 1);
+}
+
+SIMD_TARGET_AVX int SphereCloud::Solve8(Ray const& ray, unsigned int slot, int lanes, float a, float* t1, float* t2) const
+{
+	__m256 ox = _mm256_sub_ps(_mm256_set1_ps(ray.p.x), _mm256_loadu_ps(&center[0][slot]));
+	__m256 oy = _mm256_sub_ps(_mm256_set1_ps(ray.p.y), _mm256_loadu_ps(&center[1][slot]));
+	__m256 oz = _mm256_sub_ps(_mm256_set1_ps(ray.p.z), _mm256_loadu_ps(&center[2][slot]));
+	__m256 r = _mm256_loadu_ps(&radius[slot]);
+
+	__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ray.dir.x), ox), _mm256_mul_ps(_mm256_set1_ps(ray.dir.y), oy)), _mm256_mul_ps(_mm256_set1_ps(ray.dir.z), oz));
+	__m256 b = _mm256_mul_ps(_mm256_set1_ps(2.0f), dot);
+	__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy)), _mm256_mul_ps(oz, oz)), _mm256_mul_ps(r, r));
+	__m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(4 * a), c));
+	__m256 valid = _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ);
+
+	__m256 sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+	__m256 twoA = _mm256_set1_ps(2 * a);
+	__m256 negB = _mm256_sub_ps(_mm256_setzero_ps(), b);
+	_mm256_storeu_ps(t1, _mm256_div_ps(_mm256_sub_ps(negB, sqrtDisc), twoA));
+	_mm256_storeu_ps(t2, _mm256_div_ps(_mm256_add_ps(negB, sqrtDisc), twoA));
+	return _mm256_movemask_ps(valid) & ((1 << lanes) - 1);
+}
+
+#endif
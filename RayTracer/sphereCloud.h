@@ -0,0 +1,64 @@
+#pragma once
+///
+/// \file       sphereCloud.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      A set of spheres stored and intersected as one object
+///
+/// Scenes with thousands of spheres pay for a node, a transformation and a scalar test
+/// per sphere. A sphere cloud keeps the centers and radii in structure-of-arrays form,
+/// ordered by the leaves of its own BVH, and tests a leaf 4 (SSE) or 8 (AVX) spheres at a
+/// time. Texture coordinates are only computed for the closest hit.
+///
+
+#include <vector>
+#include "scene.h"
+#include "bvh.h"
+#include "simd.h"
+
+class SphereCloud : public Object
+{
+public:
+	// Builds the set from spheres given in the coordinates of the node that holds it. mtlIDs selects the
+	// sub-material of each sphere and may be empty.
+	void Build(std::vector<Vec3f> const& centers, std::vector<float> const& radii, std::vector<int> const& mtlIDs, BVHBuildParams const& params = BVHBuildParams());
+
+	bool IntersectRay(Ray const& ray, HitInfo& hInfo, int hitSide = HIT_FRONT) const override { return IntersectRayWithRecord(ray, hInfo, hitSide); }
+	bool IntersectRecord(Ray const& ray, HitRecord& hit, int hitSide = HIT_FRONT) const override;	// the primitive is the slot of the sphere
+	void EvaluateHit(Ray const& ray, HitRecord const& hit, int hitSide, HitInfo& hInfo) const override;
+	bool ShadowRay(Ray const& ray, float t_max) const override;
+	bool ShadowRayOccluder(Ray const& ray, float t_max, unsigned int& prim, unsigned int& neighborhood) const override;
+	bool ShadowRayPrimitive(Ray const& ray, float t_max, unsigned int prim) const override;
+	bool ShadowRayNeighborhood(Ray const& ray, float t_max, unsigned int neighborhood, unsigned int& prim) const override;
+	Box  GetBoundBox() const override { return bound; }
+	void ViewportDisplay(Material const* mtl) const override;
+
+	unsigned int NumSpheres() const { return count; }
+	unsigned int GetBVHNodeCount() const { return bvh.GetNumNodes(); }
+
+private:
+	std::vector<float> center[3];	// per axis, the center of each sphere in BVH leaf order
+	std::vector<float> radius;
+	std::vector<int>   mtlID;
+	unsigned int       count = 0;
+	SAHBVH             bvh;
+	Box                bound;
+
+	// Returns the slot of the closest hit in slots [first, first+n) before t, or -1. On a hit, updates t.
+	int  IntersectLeaf(Ray const& ray, int hitSide, unsigned int first, unsigned int n, float& t) const;
+	// Returns the slot of a sphere in slots [first, first+n) that blocks the ray before t_max, or -1
+	int  IntersectLeafShadow(Ray const& ray, unsigned int first, unsigned int n, float t_max) const;
+
+	// Picks the root the same way as Sphere::IntersectRecord, returns true and updates t if it is closer than t
+	static bool PickRoot(float t1, float t2, int hitSide, float& t);
+
+	// Solves the ray-sphere quadratic of the slot, returns false if the ray misses. a is the squared length of the ray direction.
+	bool Solve(Ray const& ray, unsigned int slot, float a, float& t1, float& t2) const;
+
+#if SIMD_X86
+	// Each returns the mask of lanes where the ray meets the sphere, with both roots of the lanes
+	int Solve4(Ray const& ray, unsigned int slot, int lanes, float a, float* t1, float* t2) const;
+	SIMD_TARGET_AVX int Solve8(Ray const& ray, unsigned int slot, int lanes, float a, float* t1, float* t2) const;
+#endif
+};
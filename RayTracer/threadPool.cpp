@@ -0,0 +1,98 @@
+///
+/// \file       threadPool.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the worker thread pool defined in threadPool.h
+///
+
+#include <algorithm>
+#include "threadPool.h"
+
+bool ThreadPool::Job::IsDone() const
+{
+	if (!state) return true;
+	std::lock_guard<std::mutex> lock(state->mutex);
+	return state->isDone;
+}
+
+void ThreadPool::Job::Wait() const
+{
+	if (!state) return;
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [this]() { return state->isDone; });
+}
+
+ThreadPool::ThreadPool(int numThreads)
+{
+	if (numThreads <= 0) numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	threads.reserve(numThreads);
+	for (int i = 0; i < numThreads; i++) threads.emplace_back([this]() { WorkerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		// Queued jobs still run to the end with every task skipped, so their waiters are released
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		for (auto& job : queue) job->cancel.Cancel();
+	}
+	wake.notify_all();
+	for (std::thread& t : threads) t.join();
+}
+
+ThreadPool::Job ThreadPool::Submit(int numTasks, Task task, DoneCallback done)
+{
+	Job job;
+	job.state = std::make_shared<JobState>();
+	JobState& state = *job.state;
+	state.task = std::move(task);
+	state.done = std::move(done);
+	state.numTasks = numTasks;
+	state.remaining = numTasks;
+
+	if (numTasks <= 0) {
+		FinishJob(state);
+		return job;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping) state.cancel.Cancel();
+		queue.push_back(job.state);
+	}
+	if (numTasks == 1) wake.notify_one();
+	else wake.notify_all();
+	return job;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for (;;)
+	{
+		std::shared_ptr<JobState> job;
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) return;
+			job = queue.front();
+			index = job->nextTask++;
+			if (job->nextTask == job->numTasks) queue.pop_front();
+		}
+
+		if (!job->cancel.IsCancelled()) job->task(index, job->cancel);
+		if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) FinishJob(*job);
+	}
+}
+
+void ThreadPool::FinishJob(JobState& job)
+{
+	if (job.done) job.done(job.cancel.IsCancelled());
+	{
+		std::lock_guard<std::mutex> lock(job.mutex);
+		job.isDone = true;
+	}
+	job.finished.notify_all();
+}
@@ -0,0 +1,99 @@
+#pragma once
+///
+/// \file       threadPool.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Long-lived worker threads that run the jobs of the renderer
+///
+/// The threads are started once with the pool and sleep on a condition variable between jobs,
+/// so starting a render costs no thread creation and an idle pool uses no CPU. A job is split
+/// into numbered tasks that the threads take in order. Every job has a cancel token: tasks that
+/// have not started when it is cancelled are skipped, and running tasks are expected to check the
+/// token at their own safe points. Job::Wait blocks until every task and the done callback returned.
+///
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared flag that asks the work holding a copy to stop early
+class CancelToken
+{
+public:
+	CancelToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+	void Cancel() const { flag->store(true, std::memory_order_relaxed); }
+	bool IsCancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+	std::shared_ptr<std::atomic<bool>> flag;
+};
+
+class ThreadPool
+{
+	struct JobState;
+
+public:
+	// Runs task(index, cancel) for every task index of the job
+	typedef std::function<void(int, CancelToken const&)> Task;
+	// Called once after the last task of a job, on the thread that finished it
+	typedef std::function<void(bool cancelled)> DoneCallback;
+
+	// Handle of a submitted job, an empty handle counts as a finished job
+	class Job
+	{
+	public:
+		Job() = default;
+
+		bool IsDone() const;
+		void Cancel() const { if (state) state->cancel.Cancel(); }
+		// Blocks until the job is done. Must not be called from a task or done callback of the pool.
+		void Wait() const;
+
+	private:
+		friend class ThreadPool;
+		std::shared_ptr<JobState> state;
+	};
+
+	// Starts numThreads threads, or one per hardware thread if numThreads is zero
+	explicit ThreadPool(int numThreads = 0);
+	// Cancels the queued jobs and joins the threads
+	~ThreadPool();
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	int GetNumThreads() const { return (int)threads.size(); }
+
+	// Queues numTasks tasks and returns right away. Jobs run in submission order.
+	Job Submit(int numTasks, Task task, DoneCallback done = nullptr);
+
+private:
+	struct JobState
+	{
+		Task         task;
+		DoneCallback done;
+		CancelToken  cancel;
+		int          numTasks = 0;
+		int          nextTask = 0;		// next task to hand out, guarded by the pool mutex
+		std::atomic<int> remaining{ 0 };	// tasks that have not returned yet
+		std::mutex   mutex;
+		std::condition_variable finished;
+		bool         isDone = false;	// guarded by mutex
+	};
+
+	std::vector<std::thread> threads;
+	std::deque<std::shared_ptr<JobState>> queue;	// jobs with tasks left to hand out
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void WorkerLoop();
+	static void FinishJob(JobState& job);
+};
@@ -0,0 +1,120 @@
+///
+/// \file       tileScheduler.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the work-stealing tile scheduler defined in tileScheduler.h
+///
+
+#include <algorithm>
+#include "tileScheduler.h"
+
+void TileScheduler::Init(int width, int height, int tileSize, int minTile, int numWorkers)
+{
+	minTileSize = std::max(minTile, 1);
+	numWorkers = std::max(numWorkers, 1);
+	if ((int)queues.size() != numWorkers) {
+		queues.clear();
+		for (int w = 0; w < numWorkers; w++) queues.emplace_back(new WorkerQueue);
+	}
+
+	const int tilesX = (width + tileSize - 1) / tileSize;
+	const int tilesY = (height + tileSize - 1) / tileSize;
+	const int totalTiles = tilesX * tilesY;
+
+	// Worker w gets the run of tiles [begin,end) in scanline order, with its first tile at the back
+	for (int w = 0; w < numWorkers; w++) {
+		const int begin = (int)((long long)totalTiles * w / numWorkers);
+		const int end = (int)((long long)totalTiles * (w + 1) / numWorkers);
+		std::lock_guard<std::mutex> lock(queues[w]->mutex);
+		queues[w]->tiles.clear();
+		for (int i = end - 1; i >= begin; i--) {
+			const int x0 = (i % tilesX) * tileSize;
+			const int y0 = (i / tilesX) * tileSize;
+			queues[w]->tiles.push_back({ x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) });
+		}
+	}
+	outstanding = totalTiles;
+	pushes = 0;
+}
+
+bool TileScheduler::Next(int worker, Tile& tile)
+{
+	const int numQueues = (int)queues.size();
+	for (;;)
+	{
+		const unsigned int seen = pushes.load();
+
+		if (Take(worker, false, tile)) {
+			Finish(false);
+			return true;
+		}
+
+		for (int i = 1; i < numQueues; i++) {
+			if (!Take((worker + i) % numQueues, true, tile)) continue;
+			// Keep the first half of a stolen tile and offer the second one to the other idle workers
+			Tile second;
+			bool split = Split(tile, second);
+			if (split) {
+				std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+				queues[worker]->tiles.push_back(second);
+				outstanding++;
+			}
+			Finish(split);
+			return true;
+		}
+
+		// Every deque was empty, but a stolen tile may still be split into one of them
+		std::unique_lock<std::mutex> lock(idleMutex);
+		workChanged.wait(lock, [&]() { return outstanding.load() == 0 || pushes.load() != seen; });
+		if (outstanding.load() == 0) return false;
+	}
+}
+
+void TileScheduler::Finish(bool pushed)
+{
+	const bool last = --outstanding == 0;
+	if (!pushed && !last) return;
+	{
+		std::lock_guard<std::mutex> lock(idleMutex);
+		if (pushed) pushes++;
+	}
+	workChanged.notify_all();
+}
+
+bool TileScheduler::Take(int queue, bool steal, Tile& tile)
+{
+	WorkerQueue& q = *queues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.tiles.empty()) return false;
+	if (steal) {
+		tile = q.tiles.front();
+		q.tiles.pop_front();
+	}
+	else {
+		tile = q.tiles.back();
+		q.tiles.pop_back();
+	}
+	return true;
+}
+
+bool TileScheduler::Split(Tile& tile, Tile& second) const
+{
+	const int w = tile.x1 - tile.x0;
+	const int h = tile.y1 - tile.y0;
+	const int size = std::max(w, h);
+	if (size <= minTileSize) return false;
+
+	// Cut at a multiple of the minimum size, so the pieces stay aligned to the pixel blocks
+	const int cut = std::max(size / 2 / minTileSize, 1) * minTileSize;
+	second = tile;
+	if (w >= h) {
+		tile.x1 = tile.x0 + cut;
+		second.x0 = tile.x1;
+	}
+	else {
+		tile.y1 = tile.y0 + cut;
+		second.y0 = tile.y1;
+	}
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+///
+/// \file       tileScheduler.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Work-stealing distribution of image tiles between render threads
+///
+/// The tiles of the image are dealt to the workers in contiguous runs, one deque per worker.
+/// Owners take from the back of their own deque and render those tiles whole. A worker whose
+/// deque is empty steals from the front of another one, where the tiles farthest from the
+/// owner's current work are, and splits the stolen tile in half: it renders the first half and
+/// pushes the second onto its own deque, where it can be stolen and split again. Expensive
+/// tiles near the end of the render are thereby shared out down to the minimum tile size.
+/// Workers that find every deque empty sleep until a split pushes new work or all work is taken.
+///
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct Tile
+{
+	int x0, y0, x1, y1;		// pixels [x0,x1)x[y0,y1)
+};
+
+class TileScheduler
+{
+public:
+	// Cuts a width x height image into tiles of tileSize, which should be a multiple of minTileSize
+	void Init(int width, int height, int tileSize, int minTileSize, int numWorkers);
+
+	// Takes the next tile for the worker, stealing if its own deque is empty. Returns false once no work is left.
+	bool Next(int worker, Tile& tile);
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex       mutex;
+		std::deque<Tile> tiles;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::atomic<int> outstanding{ 0 };	// tiles in the deques, plus stolen tiles not split yet
+	std::atomic<unsigned int> pushes{ 0 };	// split halves pushed so far, changed under idleMutex
+	std::mutex idleMutex;
+	std::condition_variable workChanged;	// signaled when a half is pushed or outstanding reaches zero
+	int minTileSize = 8;
+
+	bool Take(int queue, bool steal, Tile& tile);
+	// Retires a taken tile, after its second half was pushed if it was split, and wakes the idle workers if anything changed
+	void Finish(bool pushed);
+	// Cuts tile in two across its longer side, keeping the first part. Returns false if it is too small to split.
+	bool Split(Tile& tile, Tile& second) const;
+};
@@ -0,0 +1,195 @@
+///
+/// \file       triBuffer.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Methods corresponding to the precomputed triangle storage defined in triBuffer.h
+///
+
+#include <algorithm>
+#include "triBuffer.h"
+
+// The arrays are padded by this many entries so the last group of a SIMD test can always be loaded
+#define TRIBUFFER_PAD 7
+
+void TriangleBuffer::Build(TriMesh const& mesh, unsigned int const* faceOrder, unsigned int faceCount)
+{
+	Clear();
+	count = faceCount;
+	for (int a = 0; a < 3; a++)
+	{
+		v0[a].assign(count + TRIBUFFER_PAD, 0.0f);
+		e1[a].assign(count + TRIBUFFER_PAD, 0.0f);
+		e2[a].assign(count + TRIBUFFER_PAD, 0.0f);
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		TriMesh::TriFace const& face = mesh.F(faceOrder[i]);
+		Vec3f p0 = mesh.V(face.v[0]);
+		Vec3f edge1 = mesh.V(face.v[1]) - p0;
+		Vec3f edge2 = mesh.V(face.v[2]) - p0;
+		for (int a = 0; a < 3; a++)
+		{
+			v0[a][i] = p0[a];
+			e1[a][i] = edge1[a];
+			e2[a][i] = edge2[a];
+		}
+	}
+}
+
+void TriangleBuffer::Clear()
+{
+	for (int a = 0; a < 3; a++)
+	{
+		v0[a].clear(); v0[a].shrink_to_fit();
+		e1[a].clear(); e1[a].shrink_to_fit();
+		e2[a].clear(); e2[a].shrink_to_fit();
+	}
+	count = 0;
+}
+
+int TriangleBuffer::IntersectClosest(Ray const& ray, unsigned int first, unsigned int n, float& t, Vec2f& baryCoords) const
+{
+	int closest = -1;
+#if SIMD_X86
+	const int width = (n > 4 && GetCPUFeatures().avx) ? 8 : 4;
+	alignas(32) float tHit[8], u[8], v[8];
+	for (unsigned int i = 0; i < n; i += width)
+	{
+		const int lanes = std::min(width, (int)(n - i));
+		int mask = (width == 8) ? Intersect8(ray, first + i, lanes, t, tHit, u, v) : Intersect4(ray, first + i, lanes, t, tHit, u, v);
+		for (int k = 0; mask; k++, mask >>= 1)
+		{
+			if ((mask & 1) && tHit[k] < t)
+			{
+				t = tHit[k];
+				baryCoords.Set(u[k], v[k]);
+				closest = first + i + k;
+			}
+		}
+	}
+#else
+	for (unsigned int i = first; i < first + n; i++)
+	{
+		if (Intersect(ray, i, t, baryCoords)) closest = i;
+	}
+#endif
+	return closest;
+}
+
+int TriangleBuffer::IntersectAny(Ray const& ray, unsigned int first, unsigned int n, float t_max) const
+{
+#if SIMD_X86
+	const int width = (n > 4 && GetCPUFeatures().avx) ? 8 : 4;
+	alignas(32) float tHit[8], u[8], v[8];
+	for (unsigned int i = 0; i < n; i += width)
+	{
+		const int lanes = std::min(width, (int)(n - i));
+		int mask = (width == 8) ? Intersect8(ray, first + i, lanes, t_max, tHit, u, v) : Intersect4(ray, first + i, lanes, t_max, tHit, u, v);
+		for (int k = 0; mask; k++, mask >>= 1)
+		{
+			if (mask & 1) return first + i + k;
+		}
+	}
+#else
+	for (unsigned int i = first; i < first + n; i++)
+	{
+		if (IntersectShadow(ray, i, t_max)) return i;
+	}
+#endif
+	return -1;
+}
+
+#if SIMD_X86
+
+/**
+ * Moller-Trumbore against 4 triangles at once. The operations follow the scalar test in
+ * the same order and without fused multiply-adds, so the results match it exactly.
+ *
+ * @param slot   First of the 4 slots to test.
+ * @param lanes  Number of slots that belong to the leaf, the rest are masked off.
+ */
+int TriangleBuffer::Intersect4(Ray const& ray, unsigned int slot, int lanes, float t_max, float* t, float* u, float* v) const
+{
+	const __m128 epsilon = _mm_set1_ps(0.002f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	__m128 dx = _mm_set1_ps(ray.dir.x), dy = _mm_set1_ps(ray.dir.y), dz = _mm_set1_ps(ray.dir.z);
+	__m128 e1x = _mm_loadu_ps(&e1[0][slot]), e1y = _mm_loadu_ps(&e1[1][slot]), e1z = _mm_loadu_ps(&e1[2][slot]);
+	__m128 e2x = _mm_loadu_ps(&e2[0][slot]), e2y = _mm_loadu_ps(&e2[1][slot]), e2z = _mm_loadu_ps(&e2[2][slot]);
+
+	// h = dir x e2
+	__m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+	__m128 valid = _mm_cmpge_ps(_mm_and_ps(det, absMask), epsilon);
+
+	__m128 invDet = _mm_div_ps(one, det);
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(ray.p.x), _mm_loadu_ps(&v0[0][slot]));
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(ray.p.y), _mm_loadu_ps(&v0[1][slot]));
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(ray.p.z), _mm_loadu_ps(&v0[2][slot]));
+	__m128 uu = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+
+	// q = s x e1
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 vv = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+
+	__m128 tt = _mm_mul_ps(invDet, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, epsilon), _mm_cmplt_ps(tt, _mm_set1_ps(t_max))));
+
+	_mm_storeu_ps(t, tt);
+	_mm_storeu_ps(u, uu);
+	_mm_storeu_ps(v, vv);
+	return _mm_movemask_ps(valid) & ((1 << lanes) - 1);
+}
+
+SIMD_TARGET_AVX int TriangleBuffer::Intersect8(Ray const& ray, unsigned int slot, int lanes, float t_max, float* t, float* u, float* v) const
+{
+	const __m256 epsilon = _mm256_set1_ps(0.002f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	__m256 dx = _mm256_set1_ps(ray.dir.x), dy = _mm256_set1_ps(ray.dir.y), dz = _mm256_set1_ps(ray.dir.z);
+	__m256 e1x = _mm256_loadu_ps(&e1[0][slot]), e1y = _mm256_loadu_ps(&e1[1][slot]), e1z = _mm256_loadu_ps(&e1[2][slot]);
+	__m256 e2x = _mm256_loadu_ps(&e2[0][slot]), e2y = _mm256_loadu_ps(&e2[1][slot]), e2z = _mm256_loadu_ps(&e2[2][slot]);
+
+	// h = dir x e2
+	__m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+	__m256 valid = _mm256_cmp_ps(_mm256_and_ps(det, absMask), epsilon, _CMP_GE_OQ);
+
+	__m256 invDet = _mm256_div_ps(one, det);
+	__m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.p.x), _mm256_loadu_ps(&v0[0][slot]));
+	__m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.p.y), _mm256_loadu_ps(&v0[1][slot]));
+	__m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.p.z), _mm256_loadu_ps(&v0[2][slot]));
+	__m256 uu = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(uu, zero, _CMP_GE_OQ), _mm256_cmp_ps(uu, one, _CMP_LE_OQ)));
+
+	// q = s x e1
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+	__m256 vv = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(vv, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(uu, vv), one, _CMP_LE_OQ)));
+
+	__m256 tt = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+	valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tt, epsilon, _CMP_GT_OQ), _mm256_cmp_ps(tt, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+
+	_mm256_storeu_ps(t, tt);
+	_mm256_storeu_ps(u, uu);
+	_mm256_storeu_ps(v, vv);
+	return _mm256_movemask_ps(valid) & ((1 << lanes) - 1);
+}
+
+#endif
@@ -24,6 +24,7 @@
 
 #include "renderer.h"
 #include "objects.h"
+#include "sphereCloud.h"
 #include "lights.h"
 #include "materials.h"
 #include "texture.h"
@@ -809,6 +810,27 @@ void Sphere::ViewportDisplay(Material const* mtl) const
     }
     gluSphere(q, 1, 50, 50);
 }
+void SphereCloud::ViewportDisplay(Material const* mtl) const
+{
+    static GLUquadric* q = nullptr;
+    if (q == nullptr) {
+        q = gluNewQuadric();
+        gluQuadricTexture(q, true);
+    }
+    // Clouds can hold many thousands of spheres, so they are drawn coarser than a single sphere
+    int current = -1;
+    for (unsigned int i = 0; i < count; i++) {
+        if (mtl && mtlID[i] != current) {
+            current = mtlID[i];
+            mtl->SetViewportMaterial(current);
+        }
+        glPushMatrix();
+        glTranslatef(center[0][i], center[1][i], center[2][i]);
+        glScalef(radius[i], radius[i], radius[i]);
+        gluSphere(q, 1, 12, 12);
+        glPopMatrix();
+    }
+}
 void Plane::ViewportDisplay(Material const* mtl) const
 {
     const int resolution = 32;
@@ -838,6 +860,27 @@ void Plane::ViewportDisplay(Material const* mtl) const
 }
 void TriObj::ViewportDisplay(Material const* mtl) const
 {
+    if (mtl && !faceMtl.empty()) {
+        // Merged meshes switch materials wherever the per-face material ID changes
+        int current = -1;
+        glBegin(GL_TRIANGLES);
+        for (unsigned int i = 0; i < NF(); i++) {
+            if (faceMtl[i] != current) {
+                glEnd();
+                current = faceMtl[i];
+                mtl->SetViewportMaterial(current);
+                glBegin(GL_TRIANGLES);
+            }
+            for (int j = 0; j < 3; j++) {
+                if (HasTextureVertices()) glTexCoord3fv(&VT(FT(i).v[j]).x);
+                if (HasNormals()) glNormal3fv(&VN(FN(i).v[j]).x);
+                glVertex3fv(&V(F(i).v[j]).x);
+            }
+        }
+        glEnd();
+        return;
+    }
+
     unsigned int nextMtlID = 0;
     unsigned int nextMtlSwith = NF();
     if (mtl && NM() > 0) {
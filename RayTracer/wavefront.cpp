@@ -0,0 +1,394 @@
+///
+/// \file       wavefront.cpp
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Stages of the wavefront renderer defined in wavefront.h
+///
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include "wavefront.h"
+#include "rayPacket.h"
+#include "photonmap.h"
+#include "raySort.h"
+
+/**
+ * Renders a tile one sample per unconverged pixel at a time. Each sample runs the camera
+ * stage once and then extension, shading, shadow and gather stages until no rays are left.
+ */
+void WavefrontTracer::RenderTile(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton)
+{
+	const int scrWidth = renderImage.GetWidth();
+
+	Waves w;
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			PixelState px;
+			px.x = x;
+			px.y = y;
+			px.rng = RNG(y * scrWidth + x);
+			px.randomOffset = px.rng.RandomFloat();
+			px.randomOffsetY = px.rng.RandomFloat();
+			px.sumColor = Color(0, 0, 0);
+			px.sumColorSquared = Color(0, 0, 0);
+			px.totalSamples = maxSamples;
+			w.pixels.push_back(px);
+		}
+	}
+
+	std::vector<int> active(w.pixels.size());
+	std::iota(active.begin(), active.end(), 0);
+
+	// One shading context for the whole tile, the random state of each path is swapped in and out of rng
+	RNG rng;
+	ShadowRecorder info(scene.lights, scene.environment, rng, this);
+
+	//Adaptive Sampling loop
+	for (int i = 0; i < maxSamples && !active.empty(); i++)
+	{
+		for (int p : active) w.pixels[p].sample = Color(0, 0, 0);
+
+		CameraStage(w, active, i, halton);
+		while (!w.paths.empty() || !w.reshade.empty())
+		{
+			ExtensionStage(w, i);
+			ShadingStage(w, info, rng, i);
+			ShadowStage(w, info, rng, i);
+			GatherStage(w);
+		}
+
+		// Converged pixels leave the waves
+		size_t kept = 0;
+		for (int p : active)
+		{
+			PixelState& px = w.pixels[p];
+			px.sumColor += px.sample;
+			px.sumColorSquared += px.sample * px.sample;
+			if (IsConverged(px.sumColor, px.sumColorSquared, i)) px.totalSamples = i + 1;
+			else active[kept++] = p;
+		}
+		active.resize(kept);
+	}
+
+	for (PixelState const& px : w.pixels)
+	{
+		StorePixel(px.x, px.y, px.sumColor, px.totalSamples);
+	}
+	renderImage.IncrementNumRenderPixel((int)w.pixels.size());
+}
+
+// Reorders the extension queue by direction octant and origin, each path carries its own pixel and generator so the order is free
+void WavefrontTracer::SortPaths(Waves& w) const
+{
+	SortRays(w.paths.size(), [&w](size_t i) -> Ray const& { return w.paths[i].ray; }, w.sortKeys);
+	w.sortedPaths.clear();
+	for (auto const& key : w.sortKeys) w.sortedPaths.push_back(w.paths[key.second]);
+	w.paths.swap(w.sortedPaths);
+}
+
+void WavefrontTracer::CameraStage(Waves& w, std::vector<int> const& active, int sample, HaltonSeq<128> const* halton) const
+{
+	alignas(16) float pixX[RAY_PACKET_SIZE] = {}, pixY[RAY_PACKET_SIZE] = {}, lensU[RAY_PACKET_SIZE] = {}, lensV[RAY_PACKET_SIZE] = {};
+	RayPacket packet;
+
+	for (size_t first = 0; first < active.size(); first += RAY_PACKET_SIZE)
+	{
+		int n = (int)std::min(active.size() - first, (size_t)RAY_PACKET_SIZE);
+		for (int lane = 0; lane < n; lane++)
+		{
+			PixelState const& px = w.pixels[active[first + lane]];
+			SamplePixel(px.x, px.y, sample, px.randomOffset, px.randomOffsetY, halton, pixX[lane], pixY[lane], lensU[lane], lensV[lane]);
+		}
+
+		GeneratePrimaryRays(packet, pixX, pixY, lensU, lensV, (1 << n) - 1);
+
+		for (int lane = 0; lane < n; lane++)
+		{
+			PathState path;
+			path.ray = packet.Get(lane);
+			path.weight = Color(1, 1, 1);
+			path.absorption = Color(0, 0, 0);
+			path.pixel = active[first + lane];
+			path.bounce = 0;
+			path.rng = w.pixels[path.pixel].rng;	// every sample of a pixel starts from the pixel's generator, as in RenderBlock
+			w.paths.push_back(path);
+		}
+	}
+}
+
+/**
+ * Finds the closest hits of the extension queue. Misses and light hits are resolved here,
+ * the rest move to the shading queue together with the reflections waiting to be shaded again.
+ */
+void WavefrontTracer::ExtensionStage(Waves& w, int sample)
+{
+	w.shading.swap(w.reshade);
+	w.reshade.clear();
+	if (sortRays && !w.paths.empty() && w.paths[0].bounce > 0) SortPaths(w);
+
+	HitInfo hit[RAY_PACKET_SIZE];
+	RayPacket packet;
+
+	for (size_t first = 0; first < w.paths.size(); first += RAY_PACKET_SIZE)
+	{
+		int n = (int)std::min(w.paths.size() - first, (size_t)RAY_PACKET_SIZE);
+		for (int lane = 0; lane < n; lane++)
+		{
+			hit[lane].Init();
+			hit[lane].node = &scene.rootNode;
+		}
+
+		// All paths of a wave are at the same bounce. Camera rays of a tile are coherent enough for packets,
+		// the secondary rays are traced one by one.
+		int hitMask = 0;
+		if (w.paths[first].bounce == 0)
+		{
+			packet.active = 0;
+			for (int lane = 0; lane < n; lane++) packet.Set(lane, w.paths[first + lane].ray);
+			hitMask = TracePacket(packet, hit, HIT_FRONT);
+		}
+		else
+		{
+			for (int lane = 0; lane < n; lane++)
+				if (TraceRay(w.paths[first + lane].ray, hit[lane], HIT_FRONT_AND_BACK)) hitMask |= 1 << lane;
+		}
+
+		for (int lane = 0; lane < n; lane++)
+		{
+			PathState& path = w.paths[first + lane];
+			PixelState& px = w.pixels[path.pixel];
+			bool hitAny = (hitMask & (1 << lane)) != 0;
+
+			if (path.bounce == 0)
+			{
+				if (!hitAny || hit[lane].light)
+				{
+					px.sample += ShadePrimary(sample, path.ray, hit[lane], hitAny, cyVec2f((float)px.x, (float)px.y), path.rng);
+					continue;
+				}
+			}
+			else
+			{
+				if (!hitAny)
+				{
+					px.sample += path.weight * scene.environment.EvalEnvironment(path.ray.dir);
+					continue;
+				}
+				if (hit[lane].light)
+				{
+					px.sample += path.weight * Absorb(Color::White(), path.absorption, hit[lane].z);
+					continue;
+				}
+			}
+
+			Material const* mtl = ResolveMaterial(hit[lane]);
+			if (!mtl) continue;
+
+			if (path.bounce > 0)
+			{
+				// Secondary rays are absorbed over their length to front hits only, as in ShadowInfo::TraceSecondaryRay
+				float dist = hit[lane].front ? hit[lane].z * path.ray.dir.Length() : 0.0f;
+				path.weight = path.weight * Absorb(Color(1, 1, 1), path.absorption, dist);
+			}
+			w.shading.push_back({ path, hit[lane], mtl });
+		}
+	}
+
+	w.paths.clear();
+}
+
+/**
+ * Shades the hits grouped by material. MtlBlinn hits spawn their lobe rays into the next
+ * extension queue, record the shadow rays of every light and queue their photon gather;
+ * other materials are shaded recursively on the spot.
+ */
+void WavefrontTracer::ShadingStage(Waves& w, ShadowRecorder& info, RNG& rng, int sample) const
+{
+	w.order.resize(w.shading.size());
+	std::iota(w.order.begin(), w.order.end(), 0);
+	std::stable_sort(w.order.begin(), w.order.end(), [&w](int a, int b) { return std::less<Material const*>()(w.shading[a].mtl, w.shading[b].mtl); });
+	LightBVH const* lightBVH = GetLightBVH();
+
+	for (int idx : w.order)
+	{
+		ShadeItem const& item = w.shading[idx];
+		PixelState& px = w.pixels[item.path.pixel];
+		rng = item.path.rng;
+		info.Set(item, sample);
+
+		MtlBlinn const* blinn = dynamic_cast<MtlBlinn const*>(item.mtl);
+		if (!blinn)
+		{
+			info.rays = nullptr;
+			px.sample += item.path.weight * item.mtl->Shade(info);
+			continue;
+		}
+
+		MtlBlinn::Lobe lobe;
+		Color fullReflection;
+		if (blinn->SampleRefraction(info, lobe, fullReflection)) Spawn(w, item, lobe, info.N(), rng, blinn->Absorption());
+		if (blinn->SampleReflection(info, fullReflection, lobe)) Spawn(w, item, lobe, info.N(), rng, blinn->Absorption());
+
+		// Record the shadow rays of every light as if nothing was blocked, which also stops soft shadows after their first round.
+		// Lights in the light hierarchy are left to the picks that follow, as in MtlBlinn::Shade.
+		info.rays = &w.shadowRays;
+		info.visibility = 1.0f;
+		for (int l = 0; l < info.NumLights(); l++)
+		{
+			if (lightBVH && lightBVH->IsClustered(l)) continue;
+			if (info.GetLight(l)->IsAmbient()) continue;
+			RecordLight(w, info, rng, idx, l, item.path.weight, blinn);
+		}
+		if (lightBVH)
+		{
+			for (int s = 0; s < lightBVH->samplesPerShade; s++)
+			{
+				float prob;
+				int l = lightBVH->Sample(info.P(), info.RandomFloat(), prob);
+				if (l < 0) break;
+				RecordLight(w, info, rng, idx, l, item.path.weight / (prob * lightBVH->samplesPerShade), blinn);
+			}
+		}
+
+		Color kd = blinn->Diffuse().Eval(info.UVW());
+		w.gathers.push_back({ info.P(), info.N(), item.path.weight * (1.0f / M_PI) * kd, item.path.pixel, info.isSecondary });
+		px.sample += item.path.weight * blinn->Emission().Eval(info.UVW());
+	}
+}
+
+// Runs Illuminate of light l for shading item idx, queuing its shadow rays, or adds its contribution right away if it fired none
+void WavefrontTracer::RecordLight(Waves& w, ShadowRecorder& info, RNG const& rng, int idx, int l, Color const& weight, MtlBlinn const* blinn) const
+{
+	LightSample ls;
+	ls.item = idx;
+	ls.light = l;
+	ls.rng = rng;
+	ls.first = (int)w.shadowRays.size();
+	Vec3f lightDir;
+	Color intensity = info.GetLight(l)->Illuminate(info, lightDir);
+	ls.count = (int)w.shadowRays.size() - ls.first;
+	ls.contribution = weight * intensity * blinn->EvalBRDF(info, lightDir);
+	if (ls.count == 0) w.pixels[w.shading[idx].path.pixel].sample += ls.contribution;
+	else w.lightSamples.push_back(ls);
+}
+
+void WavefrontTracer::Spawn(Waves& w, ShadeItem const& item, MtlBlinn::Lobe const& lobe, Vec3f const& N, RNG const& rng, Color const& absorption) const
+{
+	ShadeItem child;
+	child.path.ray = lobe.ray;
+	child.path.weight = item.path.weight * lobe.weight;
+	child.path.absorption = absorption;
+	child.path.pixel = item.path.pixel;
+	child.path.bounce = item.path.bounce + 1;
+	child.path.rng = rng;
+
+	// Like ShadowInfo::TraceSecondaryRay, a reflection below the surface shades the same hit point again
+	if (lobe.reflection && lobe.ray.dir.Dot(N) < 0)
+	{
+		child.hit = item.hit;
+		child.mtl = item.mtl;
+		w.reshade.push_back(child);
+	}
+	else w.paths.push_back(child.path);
+}
+
+/**
+ * Traces the shadow rays of the wave. Lights whose first round was partly blocked replay
+ * Illuminate with every ray answered as blocked, which makes them fire all of their samples,
+ * and the additional rays are traced in a second round.
+ */
+void WavefrontTracer::ShadowStage(Waves& w, ShadowRecorder& info, RNG& rng, int sample) const
+{
+	w.shadowHits.resize(w.shadowRays.size());
+	for (size_t k = 0; k < w.shadowRays.size(); k++)
+		w.shadowHits[k] = IsBlocked(w.shadowRays[k]);
+
+	std::vector<ShadowRay> replay;
+	size_t firstExtra = w.shadowRays.size();
+	w.secondRound.clear();
+	for (LightSample& ls : w.lightSamples)
+	{
+		PixelState& px = w.pixels[w.shading[ls.item].path.pixel];
+		ls.visible = 0;
+		for (int k = ls.first; k < ls.first + ls.count; k++) ls.visible += !w.shadowHits[k];
+		if (ls.visible == ls.count)
+		{
+			px.sample += ls.contribution;
+			continue;
+		}
+
+		rng = ls.rng;
+		info.Set(w.shading[ls.item], sample);
+		replay.clear();
+		info.rays = &replay;
+		info.visibility = 0.0f;
+		Vec3f lightDir;
+		info.GetLight(ls.light)->Illuminate(info, lightDir);
+
+		// The first rays of the replay are the ones already traced
+		int total = std::max((int)replay.size(), ls.count);
+		if (total == ls.count)
+		{
+			px.sample += ls.contribution * ((float)ls.visible / (float)ls.count);
+			continue;
+		}
+
+		LightSample second = ls;
+		second.first = (int)w.shadowRays.size();
+		second.count = total - ls.count;
+		second.contribution = ls.contribution / (float)total;	// times the unblocked rays of both rounds
+		w.shadowRays.insert(w.shadowRays.end(), replay.begin() + ls.count, replay.end());
+		w.secondRound.push_back(second);
+	}
+
+	w.shadowHits.resize(w.shadowRays.size());
+	for (size_t k = firstExtra; k < w.shadowRays.size(); k++)
+		w.shadowHits[k] = IsBlocked(w.shadowRays[k]);
+
+	for (LightSample const& ls : w.secondRound)
+	{
+		int visible = ls.visible;
+		for (int k = ls.first; k < ls.first + ls.count; k++) visible += !w.shadowHits[k];
+		w.pixels[w.shading[ls.item].path.pixel].sample += ls.contribution * (float)visible;
+	}
+
+	w.shadowRays.clear();
+	w.lightSamples.clear();
+}
+
+// Shadow rays recorded with a light go through the occluder cache of that light
+bool WavefrontTracer::IsBlocked(ShadowRay const& shadowRay) const
+{
+	if (shadowRay.light) return TraceShadowRay(shadowRay.ray, shadowRay.tMax, shadowRay.light);
+	return TraceShadowRay(shadowRay.ray, shadowRay.tMax);
+}
+
+/**
+ * Photon map lookups of the wave, first hits against the global map and then secondary
+ * hits against the caustics map, so each kd-tree stays in cache for its whole batch.
+ */
+void WavefrontTracer::GatherStage(Waves& w) const
+{
+	for (int secondary = 0; secondary < 2; secondary++)
+	{
+		for (Gather const& g : w.gathers)
+		{
+			if (g.secondary != (secondary != 0)) continue;
+			w.pixels[g.pixel].sample += g.weight * GatherPhotonIrradiance(this, g.secondary, g.p, g.n);
+		}
+	}
+	w.gathers.clear();
+}
+
+// The material that shades a hit, looking through multi-materials to the sub-material of the hit
+Material const* WavefrontTracer::ResolveMaterial(HitInfo const& hit)
+{
+	Material const* mtl = hit.node->GetMaterial();
+	MultiMtl const* multi = dynamic_cast<MultiMtl const*>(mtl);
+	if (multi && hit.mtlID >= 0 && hit.mtlID < multi->NumMaterials()) mtl = multi->GetMaterial(hit.mtlID);
+	return mtl;
+}
@@ -0,0 +1,158 @@
+#pragma once
+///
+/// \file       wavefront.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      Ray tracer that processes the rays of a tile in stages instead of recursively
+///
+/// The recursive renderer shades a hit point, traces its secondary and shadow rays and shades
+/// their hits before moving on, so each ray finds the hierarchies and photon maps cold. This
+/// renderer keeps one queue per stage for all pixels of a tile that still need samples:
+///
+///   camera     primary rays, generated 8 at a time (SSE)
+///   extension  closest hits, primary rays traced as 8-ray packets, secondary rays optionally sorted (SetSortRays)
+///   shading    hits sorted by material, MtlBlinn is split into lobes, light samples and gathers
+///   shadow     every shadow ray of the wave, then the adaptive second round of soft shadows
+///   gather     photon map lookups
+///
+/// Secondary rays spawned by shading form the next extension wave. Materials other than MtlBlinn
+/// are shaded recursively by their own Shade. The image converges to the same result as the
+/// recursive renderer; random numbers are drawn in a different order, so noise differs.
+///
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include "raytracer.h"
+#include "shadowInfo.h"
+#include "materials.h"
+
+class WavefrontTracer : public RayTracer
+{
+public:
+	// Stops the render before this class is gone, the workers call RenderTile through it
+	~WavefrontTracer() { StopRender(); }
+
+protected:
+	void RenderTile(int x0, int y0, int x1, int y1, HaltonSeq<128> const* halton) override;
+
+private:
+	// A ray in flight and what its color is worth to the sample of its pixel
+	struct PathState
+	{
+		Ray   ray;
+		Color weight;
+		Color absorption;	// absorbed over the length of the ray before weighting
+		int   pixel;		// index into the pixel list of the tile
+		int   bounce;		// zero for camera rays
+		RNG   rng;
+	};
+
+	// A hit waiting for its material
+	struct ShadeItem
+	{
+		PathState       path;
+		HitInfo         hit;
+		Material const* mtl;
+	};
+
+	struct ShadowRay
+	{
+		Ray          ray;
+		float        tMax;
+		Light const* light;	// goes through the occluder cache of the light, if not null
+	};
+
+	// The shadow rays one light fired for one shading item. Illuminate is assumed to scale its
+	// unshadowed result by the fraction of unblocked rays, which holds for the point and direct lights.
+	struct LightSample
+	{
+		int   item;			// index of the shading item
+		int   light;
+		RNG   rng;			// state before Illuminate, so it can be replayed for the second round
+		Color contribution;	// path weight * unshadowed intensity * BRDF
+		int   first, count;	// shadow rays in the wave
+		int   visible;
+	};
+
+	struct Gather
+	{
+		Vec3f p, n;
+		Color weight;
+		int   pixel;
+		bool  secondary;
+	};
+
+	struct PixelState
+	{
+		int   x, y;
+		RNG   rng;
+		float randomOffset, randomOffsetY;
+		Color sumColor, sumColorSquared;
+		Color sample;	// color of the current sample, accumulated by the stages
+		int   totalSamples;
+	};
+
+	// Stage queues of a tile
+	struct Waves
+	{
+		std::vector<PixelState>  pixels;
+		std::vector<PathState>   paths;		// extension queue
+		std::vector<ShadeItem>   shading;
+		std::vector<ShadeItem>   reshade;		// reflections that shade the same hit again, skip extension
+		std::vector<int>         order;		// shading items sorted by material
+		std::vector<ShadowRay>   shadowRays;
+		std::vector<char>        shadowHits;
+		std::vector<LightSample> lightSamples;
+		std::vector<LightSample> secondRound;
+		std::vector<Gather>      gathers;
+		std::vector<PathState>   sortedPaths;	// extension queue reordered by SortPaths
+		std::vector<std::pair<uint64_t, uint32_t>> sortKeys;
+	};
+
+	// Records the shadow rays of Illuminate instead of tracing them, answering every one with the given visibility
+	class ShadowRecorder : public ShadowInfo
+	{
+	public:
+		ShadowRecorder(std::vector<Light*> const& lightList, TexturedColor const& environment, RNG& r, RayTracer* renderer)
+			: ShadowInfo(lightList, environment, r, renderer) {}
+
+		std::vector<ShadowRay>* rays = nullptr;	// traces normally when null
+		float visibility = 1.0f;
+
+		float TraceShadowRay(Ray const& ray, float t_max = BIGFLOAT) const override
+		{
+			if (!rays) return renderer->TraceShadowRay(ray, t_max) ? 0.0f : 1.0f;
+			rays->push_back({ ray, t_max, nullptr });
+			return visibility;
+		}
+
+		float TraceShadowRay(Ray const& ray, float t_max, Light const* light) const override
+		{
+			if (!rays) return renderer->TraceShadowRay(ray, t_max, light) ? 0.0f : 1.0f;
+			rays->push_back({ ray, t_max, light });
+			return visibility;
+		}
+
+		void Set(ShadeItem const& item, int pixelSample)
+		{
+			SetPixelSample(pixelSample);
+			SetHit(item.path.ray, item.hit);
+			SetBounce(item.path.bounce);
+			isSecondary = item.path.bounce > 0;
+		}
+	};
+
+	void CameraStage(Waves& w, std::vector<int> const& active, int sample, HaltonSeq<128> const* halton) const;
+	void ExtensionStage(Waves& w, int sample);
+	void SortPaths(Waves& w) const;
+	void ShadingStage(Waves& w, ShadowRecorder& info, RNG& rng, int sample) const;
+	void ShadowStage(Waves& w, ShadowRecorder& info, RNG& rng, int sample) const;
+	void GatherStage(Waves& w) const;
+	bool IsBlocked(ShadowRay const& shadowRay) const;
+
+	void RecordLight(Waves& w, ShadowRecorder& info, RNG const& rng, int idx, int l, Color const& weight, MtlBlinn const* blinn) const;
+	void Spawn(Waves& w, ShadeItem const& item, MtlBlinn::Lobe const& lobe, Vec3f const& N, RNG const& rng, Color const& absorption) const;
+	static Material const* ResolveMaterial(HitInfo const& hit);
+};
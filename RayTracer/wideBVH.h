@@ -0,0 +1,241 @@
+#pragma once
+///
+/// \file       wideBVH.h
+/// \author     Devin Fink
+/// \date       October 16, 2026
+///
+/// \brief      4-wide and 8-wide BVH layouts collapsed from a binary SAHBVH
+///
+/// Each node keeps the boxes of all of its children in structure-of-arrays form,
+/// so a single SSE (4-wide) or AVX (8-wide) slab test checks all of them at once.
+/// Elements are not copied; leaves index the element list of the source SAHBVH.
+///
+
+#include <vector>
+#include <algorithm>
+#include "bvh.h"
+#include "simd.h"
+
+template <int N>
+struct alignas(32) WideBVHNode
+{
+	float        bmin[3][N];	// per axis, the minimum of each child box
+	float        bmax[3][N];	// per axis, the maximum of each child box
+	unsigned int child[N];		// node index for interior children, first element slot of the binary hierarchy for leaf children
+	unsigned int count[N];		// element count for leaf children, zero for interior children
+	int          numChildren;
+};
+
+//-------------------------------------------------------------------------------
+
+template <int N>
+class WideBVH
+{
+public:
+	static const int width = N;
+
+	// Collapses the binary hierarchy, pulling up the largest grandchildren until each node has N children
+	void Build(SAHBVH const& bvh)
+	{
+		Clear();
+		if (bvh.IsEmpty()) return;
+		Collapse(bvh, bvh.GetRootNodeID());
+	}
+	void Clear() { nodes.clear(); }
+
+	bool                  IsEmpty() const { return nodes.empty(); }
+	unsigned int          GetNumNodes() const { return (unsigned int)nodes.size(); }
+	WideBVHNode<N> const& GetNode(unsigned int nodeID) const { BVH_TOUCH_NODE(&nodes[nodeID]); return nodes[nodeID]; }
+	size_t                GetMemoryUsage() const { return nodes.size() * sizeof(WideBVHNode<N>); }
+
+	// Tests the child boxes of a node like IntersectChildren, and writes the child node index or first element slot,
+	// and the element count (zero for interior children) of every child
+	int IntersectChildren(unsigned int nodeID, Ray const& ray, float t_max, float* tNear, unsigned int* child, unsigned int* count) const;
+
+private:
+	std::vector<WideBVHNode<N>> nodes;
+
+	unsigned int Collapse(SAHBVH const& bvh, unsigned int binaryNodeID)
+	{
+		std::vector<unsigned int> children;
+		if (bvh.IsLeafNode(binaryNodeID)) children.push_back(binaryNodeID);
+		else {
+			unsigned int c1, c2;
+			bvh.GetChildNodes(binaryNodeID, c1, c2);
+			children.push_back(c1);
+			children.push_back(c2);
+		}
+
+		while ((int)children.size() < N) {
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int i = 0; i < (int)children.size(); i++) {
+				if (bvh.IsLeafNode(children[i])) continue;
+				float area = SurfaceArea(Box(bvh.GetNodeBounds(children[i])));
+				if (area > bestArea) { bestArea = area; best = i; }
+			}
+			if (best < 0) break;
+			unsigned int c1, c2;
+			bvh.GetChildNodes(children[best], c1, c2);
+			children[best] = c1;
+			children.push_back(c2);
+		}
+
+		const unsigned int nodeID = (unsigned int)nodes.size();
+		nodes.push_back(WideBVHNode<N>());
+		WideBVHNode<N> node = {};
+		node.numChildren = (int)children.size();
+
+		for (int i = 0; i < node.numChildren; i++) {
+			float const* b = bvh.GetNodeBounds(children[i]);
+			for (int a = 0; a < 3; a++) {
+				node.bmin[a][i] = b[a];
+				node.bmax[a][i] = b[a + 3];
+			}
+			if (bvh.IsLeafNode(children[i])) {
+				// Leaves keep referring to the element list of the binary hierarchy, so both layouts share the same element order
+				node.child[i] = bvh.GetNode(children[i]).offset;
+				node.count[i] = bvh.GetNodeElementCount(children[i]);
+			}
+			else {
+				node.child[i] = Collapse(bvh, children[i]);
+				node.count[i] = 0;
+			}
+		}
+
+		nodes[nodeID] = node;
+		return nodeID;
+	}
+};
+
+//-------------------------------------------------------------------------------
+// Child box tests
+//
+// Each returns a bit mask of the boxes the ray enters between 0 and t_max, and
+// writes the entry distance of every box to tNear. The near and far planes of
+// each axis are picked by the ray direction signs before the test, so the
+// distances need no min/max swap and each is one multiply-subtract.
+//-------------------------------------------------------------------------------
+
+inline int SlabTestScalar(int n, float const* const nearPlane[3], float const* const farPlane[3], Ray const& ray, float t_max, float* tNear)
+{
+	int mask = 0;
+	for (int i = 0; i < n; i++) {
+		float tmin = 0.0f, tmax = t_max;
+		for (int a = 0; a < 3; a++) {
+			tmin = std::max(tmin, nearPlane[a][i] * ray.invDir[a] - ray.pInvDir[a]);
+			tmax = std::min(tmax, farPlane[a][i] * ray.invDir[a] - ray.pInvDir[a]);
+		}
+		tNear[i] = tmin;
+		if (tmin <= tmax) mask |= 1 << i;
+	}
+	return mask;
+}
+
+#if SIMD_X86
+
+inline int SlabTest4(float const* const nearPlane[3], float const* const farPlane[3], Ray const& ray, float t_max, float* tNear)
+{
+	__m128 tmin = _mm_setzero_ps();
+	__m128 tmax = _mm_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m128 inv = _mm_set1_ps(ray.invDir[a]);
+		__m128 pInv = _mm_set1_ps(ray.pInvDir[a]);
+		tmin = _mm_max_ps(tmin, _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(nearPlane[a]), inv), pInv));
+		tmax = _mm_min_ps(tmax, _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(farPlane[a]), inv), pInv));
+	}
+	_mm_storeu_ps(tNear, tmin);
+	return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+
+SIMD_TARGET_AVX inline int SlabTest8(float const* const nearPlane[3], float const* const farPlane[3], Ray const& ray, float t_max, float* tNear)
+{
+	__m256 tmin = _mm256_setzero_ps();
+	__m256 tmax = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256 inv = _mm256_set1_ps(ray.invDir[a]);
+		__m256 pInv = _mm256_set1_ps(ray.pInvDir[a]);
+		tmin = _mm256_max_ps(tmin, _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(nearPlane[a]), inv), pInv));
+		tmax = _mm256_min_ps(tmax, _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(farPlane[a]), inv), pInv));
+	}
+	_mm256_storeu_ps(tNear, tmin);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+
+// SlabTest8 with fused multiply-subtracts, for CPUs with AVX2 and FMA
+SIMD_TARGET_AVX2 inline int SlabTest8FMA(float const* const nearPlane[3], float const* const farPlane[3], Ray const& ray, float t_max, float* tNear)
+{
+	__m256 tmin = _mm256_setzero_ps();
+	__m256 tmax = _mm256_set1_ps(t_max);
+	for (int a = 0; a < 3; a++) {
+		__m256 inv = _mm256_set1_ps(ray.invDir[a]);
+		__m256 pInv = _mm256_set1_ps(ray.pInvDir[a]);
+		tmin = _mm256_max_ps(tmin, _mm256_fmsub_ps(_mm256_loadu_ps(nearPlane[a]), inv, pInv));
+		tmax = _mm256_min_ps(tmax, _mm256_fmsub_ps(_mm256_loadu_ps(farPlane[a]), inv, pInv));
+	}
+	_mm256_storeu_ps(tNear, tmin);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+
+#endif
+
+// Points nearPlane and farPlane at the child box planes the ray crosses first and last on every axis
+template <int N>
+inline void SelectSlabPlanes(WideBVHNode<N> const& node, Ray const& ray, float const* nearPlane[3], float const* farPlane[3])
+{
+	for (int a = 0; a < 3; a++) {
+		nearPlane[a] = ray.sign[a] ? node.bmax[a] : node.bmin[a];
+		farPlane[a] = ray.sign[a] ? node.bmin[a] : node.bmax[a];
+	}
+}
+
+template <int N>
+inline int IntersectChildren(WideBVHNode<N> const& node, Ray const& ray, float t_max, float* tNear)
+{
+	float const* nearPlane[3];
+	float const* farPlane[3];
+	SelectSlabPlanes(node, ray, nearPlane, farPlane);
+	return SlabTestScalar(node.numChildren, nearPlane, farPlane, ray, t_max, tNear);
+}
+
+#if SIMD_X86
+
+template <>
+inline int IntersectChildren<4>(WideBVHNode<4> const& node, Ray const& ray, float t_max, float* tNear)
+{
+	float const* nearPlane[3];
+	float const* farPlane[3];
+	SelectSlabPlanes(node, ray, nearPlane, farPlane);
+	return SlabTest4(nearPlane, farPlane, ray, t_max, tNear) & ((1 << node.numChildren) - 1);
+}
+
+template <>
+inline int IntersectChildren<8>(WideBVHNode<8> const& node, Ray const& ray, float t_max, float* tNear)
+{
+	float const* nearPlane[3];
+	float const* farPlane[3];
+	SelectSlabPlanes(node, ray, nearPlane, farPlane);
+	int mask;
+	if (GetCPUFeatures().avx2) mask = SlabTest8FMA(nearPlane, farPlane, ray, t_max, tNear);
+	else if (GetCPUFeatures().avx) mask = SlabTest8(nearPlane, farPlane, ray, t_max, tNear);
+	else {
+		// No AVX on this machine, so test the two halves with SSE
+		float const* nearPlane2[3] = { nearPlane[0] + 4, nearPlane[1] + 4, nearPlane[2] + 4 };
+		float const* farPlane2[3] = { farPlane[0] + 4, farPlane[1] + 4, farPlane[2] + 4 };
+		mask = SlabTest4(nearPlane, farPlane, ray, t_max, tNear) | (SlabTest4(nearPlane2, farPlane2, ray, t_max, tNear + 4) << 4);
+	}
+	return mask & ((1 << node.numChildren) - 1);
+}
+
+#endif
+
+template <int N>
+inline int WideBVH<N>::IntersectChildren(unsigned int nodeID, Ray const& ray, float t_max, float* tNear, unsigned int* child, unsigned int* count) const
+{
+	WideBVHNode<N> const& node = GetNode(nodeID);
+	for (int i = 0; i < node.numChildren; i++) {
+		child[i] = node.child[i];
+		count[i] = node.count[i];
+	}
+	return ::IntersectChildren(node, ray, t_max, tNear);
+}
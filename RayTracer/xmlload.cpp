@@ -18,9 +18,15 @@
 #include "renderer.h"
 #include "xmlload.h"
 #include "objects.h"
+#include "sphereCloud.h"
+#include "bvhCache.h"
 #include "lights.h"
 #include "materials.h"
 #include "texture.h"
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 //-------------------------------------------------------------------------------
 
@@ -29,11 +35,27 @@ Plane  thePlane;
 
 //-------------------------------------------------------------------------------
 
-void LoadNode(Loader loader, Node& parent, ObjFileList& objList);
+// A mesh file that is read and built on a worker thread once the scene is parsed
+struct MeshLoad
+{
+    TriObj*        tobj;
+    BVHBuildParams bvhParams;
+    TriangleLayout triLayout;
+    bool           deferBVH;    // <bvh build="lazy">, the BVH is built when a ray first enters the mesh
+    bool           loaded;
+};
+typedef std::vector<MeshLoad> MeshLoadList;
+
+void LoadNode(Loader loader, Node& parent, ObjFileList& objList, MeshLoadList& meshLoads);
+void LoadMeshes(Node& root, ObjFileList& objList, MeshLoadList& meshLoads);
 void LoadLight(Loader loader, LightList& lights);
 void LoadMaterial(Loader loader, MaterialList& materials, TextureFileList& texFiles);
 void SetNodeMaterials(Node* node, MaterialList& materials, TextureFileList& texFiles);
 
+void ReadBVHParams(Loader loader, BVHBuildParams& bvhParams, TriangleLayout& triLayout);
+void MergeStaticMeshes(Node& root, ObjFileList& objList, MaterialList& materials, BVHBuildParams const& bvhParams, TriangleLayout triLayout);
+void ConvertSphereRuns(Node& root, ObjFileList& objList, MaterialList& materials, BVHBuildParams const& bvhParams, int minSpheres);
+
 TextureFile* ReadTextureFile(TextureFileList& texFiles, char const* filename);
 Material* CreateMultiMtl(TextureFileList& texFiles, TriObj const* tobj);
 
@@ -86,8 +108,30 @@ void Scene::Load(Loader const& sceneLoader)
     materials.DeleteAll();
     texFiles.DeleteAll();
 
+    bool merge = false;
+    BVHBuildParams mergeParams;
+    TriangleLayout mergeLayout = TRIANGLES_COMPACT;
+    int minCloudSpheres = 0;
+    BVHBuildParams cloudParams;
+
+    // bvhcache="dir" moves the mesh BVH cache, bvhcache="" turns it off
+    Loader::String cacheDir = sceneLoader.Attribute("bvhcache");
+    SetBVHCacheDirectory(cacheDir ? (char const*)cacheDir : "bvhcache");
+
+    MeshLoadList meshLoads;
+
     for (Loader loader : sceneLoader) {
-        if (loader == "object") LoadNode(loader, rootNode, objList);
+        if (loader == "object") LoadNode(loader, rootNode, objList, meshLoads);
+        else if (loader == "merge") {
+            merge = true;
+            ReadBVHParams(loader, mergeParams, mergeLayout);
+        }
+        else if (loader == "spherecloud") {
+            TriangleLayout unused;
+            minCloudSpheres = 16;
+            loader.ReadInt(minCloudSpheres, "minspheres");
+            ReadBVHParams(loader, cloudParams, unused);
+        }
         else if (loader == "light") LoadLight(loader, lights);
         else if (loader == "material") LoadMaterial(loader, materials, texFiles);
         else if (loader == "background") loader.ReadTexturedColor(background, texFiles);
@@ -95,9 +139,20 @@ void Scene::Load(Loader const& sceneLoader)
         else printf("WARNING: Unknown tag \"%s\"\n", static_cast<char const*>(loader.Tag()));
     }
 
+    LoadMeshes(rootNode, objList, meshLoads);
     rootNode.ComputeChildBoundBox();
 
     SetNodeMaterials(&rootNode, materials, texFiles);
+
+    if (minCloudSpheres > 0) {
+        ConvertSphereRuns(rootNode, objList, materials, cloudParams, minCloudSpheres);
+        rootNode.ComputeChildBoundBox();
+    }
+
+    if (merge) {
+        MergeStaticMeshes(rootNode, objList, materials, mergeParams, mergeLayout);
+        rootNode.ComputeChildBoundBox();
+    }
 }
 
 //-------------------------------------------------------------------------------
@@ -122,7 +177,7 @@ void Camera::Load(Loader const& loader)
 
 //-------------------------------------------------------------------------------
 
-void LoadNode(Loader loader, Node& parent, ObjFileList& objList)
+void LoadNode(Loader loader, Node& parent, ObjFileList& objList, MeshLoadList& meshLoads)
 {
     Node* node = new Node;
     parent.AppendChild(node);
@@ -144,19 +199,16 @@ void LoadNode(Loader loader, Node& parent, ObjFileList& objList)
         else if (type == "plane") node->SetNodeObj(&thePlane);
         else if (type == "obj") {
             TriObj* tobj = (TriObj*)objList.Find(name);
-            if (tobj == nullptr) {    // object is not on the list, so we should load it now
-                tobj = new TriObj;
-                if (!tobj->Load(name)) {
-                    printf("ERROR: Cannot load file \"%s.\"", name);
-                    delete tobj;
-                    tobj = nullptr;
-                }
-                else {
-                    tobj->SetName(name);
-                    objList.push_back(tobj);    // add to the list
-                }
+            if (tobj == nullptr) {    // object is not on the list, so we should queue it for loading
+                MeshLoad mesh;
+                ReadBVHParams(loader.Child("bvh"), mesh.bvhParams, mesh.triLayout);
+                mesh.deferBVH = (loader.Child("bvh").Attribute("build") == "lazy");
+                mesh.tobj = tobj = new TriObj;
+                mesh.loaded = false;
+                meshLoads.push_back(mesh);
+                tobj->SetName(name);
+                objList.push_back(tobj);    // add to the list, so other nodes share it
             }
-            if (mtlName == nullptr && tobj && tobj->NM() > 0) node->SetMaterial((Material*)tobj);  // temporarily set the material pointer to the object
             node->SetNodeObj(tobj);
         }
         else printf("ERROR: Unknown object type %s\n", static_cast<char const*>(type));
@@ -167,12 +219,98 @@ void LoadNode(Loader loader, Node& parent, ObjFileList& objList)
 
     // Load child nodes
     for (Loader L : loader) {
-        if (L == "object") LoadNode(L, *node, objList);
+        if (L == "object") LoadNode(L, *node, objList, meshLoads);
     }
 }
 
 //-------------------------------------------------------------------------------
 
+static void SetMeshNodes(Node* node, std::map<Object const*, MeshLoad const*> const& meshes)
+{
+    auto it = meshes.find(node->GetNodeObj());
+    if (it != meshes.end()) {
+        TriObj* tobj = it->second->tobj;
+        if (!it->second->loaded) node->SetNodeObj(nullptr);
+        else if (node->GetMaterial() == nullptr && tobj->NM() > 0) node->SetMaterial((Material*)tobj);  // temporarily set the material pointer to the object
+    }
+    for (int i = 0; i < node->GetNumChild(); i++) SetMeshNodes(node->GetChild(i), meshes);
+}
+
+/*
+* Reads the queued mesh files and builds their BVHs, several meshes at a time. The BVH builds split
+* the remaining cores between them. Results are reported in scene order once every mesh is done.
+* Meshes with a lazy BVH are only read here, TriObj::EnsureBVH builds them during the render.
+*/
+void LoadMeshes(Node& root, ObjFileList& objList, MeshLoadList& meshLoads)
+{
+    if (meshLoads.empty()) return;
+
+    const int numCores = std::max((int)std::thread::hardware_concurrency(), 1);
+    const int numWorkers = std::min(numCores, (int)meshLoads.size());
+    std::atomic<int> nextMesh{ 0 };
+
+    auto worker = [&]() {
+        for (int i = nextMesh++; i < (int)meshLoads.size(); i = nextMesh++) {
+            MeshLoad& mesh = meshLoads[i];
+            BVHBuildParams params = mesh.bvhParams;
+            if (params.numThreads == 0 && !mesh.deferBVH) params.numThreads = std::max(numCores / numWorkers, 1);
+            mesh.loaded = mesh.tobj->Load(mesh.tobj->GetName(), params, mesh.triLayout, mesh.deferBVH);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numWorkers; i++) threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads) t.join();
+
+    std::map<Object const*, MeshLoad const*> meshes;
+    for (MeshLoad const& mesh : meshLoads) {
+        TriObj* tobj = mesh.tobj;
+        char const* name = tobj->GetName();
+        meshes[tobj] = &mesh;
+        if (!mesh.loaded) {
+            printf("ERROR: Cannot load file \"%s.\"", name);
+            continue;
+        }
+        if (mesh.deferBVH) {
+            printf("Loaded \"%s\": %u faces, BVH deferred until a ray enters it\n", name, tobj->NF());
+            continue;
+        }
+        printf("Loaded \"%s\": %u faces, %u BVH nodes, SAH cost %.2f%s\n", name, tobj->NF(), tobj->GetBVHNodeCount(), tobj->GetBVHCost(), tobj->IsBVHCached() ? " (cached)" : "");
+        if (mesh.bvhParams.spatialSplits) printf("  spatial splits: %u references (%u duplicated)\n", tobj->GetBVHReferenceCount(), tobj->GetBVHReferenceCount() - tobj->NF());
+        if (tobj->IsBVHQuantized()) printf("  quantized nodes: %.1f MB\n", tobj->GetBVHNodeMemory() / (1024.0 * 1024.0));
+        if (mesh.triLayout == TRIANGLES_FAST) printf("  precomputed triangles: %.1f MB\n", tobj->GetTriangleBufferSize() / (1024.0 * 1024.0));
+    }
+
+    SetMeshNodes(&root, meshes);
+
+    for (MeshLoad const& mesh : meshLoads) {
+        if (mesh.loaded) continue;
+        objList.erase(std::find(objList.begin(), objList.end(), mesh.tobj));
+        delete mesh.tobj;
+    }
+    meshLoads.clear();
+}
+
+//-------------------------------------------------------------------------------
+
+void ReadBVHParams(Loader loader, BVHBuildParams& bvhParams, TriangleLayout& triLayout)
+{
+    int n;
+    if (loader.ReadInt(n, "bins")) bvhParams.binCount = n;
+    if (loader.ReadInt(n, "leafsize")) bvhParams.maxLeafSize = n;
+    loader.ReadInt(bvhParams.width, "width");
+    loader.ReadFloat(bvhParams.leafCost, "leafcost");
+    loader.ReadFloat(bvhParams.traversalCost, "traversalcost");
+    bvhParams.spatialSplits = (loader.Attribute("split") == "spatial");
+    bvhParams.quantized = (loader.Attribute("nodes") == "quantized");
+    loader.ReadFloat(bvhParams.duplicateBudget, "budget");
+    loader.ReadFloat(bvhParams.spatialAlpha, "alpha");
+    loader.ReadInt(bvhParams.numThreads, "threads");
+    triLayout = (loader.Attribute("triangles") == "fast") ? TRIANGLES_FAST : TRIANGLES_COMPACT;
+}
+
+//-------------------------------------------------------------------------------
+
 void Transformation::Load(Loader const& loader)
 {
     for (Loader const& L : loader) {
@@ -316,6 +454,188 @@ void SetNodeMaterials(Node* node, MaterialList& materials, TextureFileList& texF
 
 //-------------------------------------------------------------------------------
 
+static void CountObjectUses(Node const* node, std::map<Object const*, int>& uses)
+{
+    if (node->GetNodeObj()) uses[node->GetNodeObj()]++;
+    for (int i = 0; i < node->GetNumChild(); i++) CountObjectUses(node->GetChild(i), uses);
+}
+
+static void CollectStaticMeshes(Node* node, Matrix34f const& parentTM, std::map<Object const*, int> const& uses, std::vector<Node*>& nodes, std::vector<TriObj::MergeSource>& sources)
+{
+    Matrix34f tm = parentTM * node->GetTransform();
+
+    // Only meshes used by a single node are merged, instanced meshes keep sharing one copy
+    TriObj* tobj = dynamic_cast<TriObj*>(node->GetNodeObj());
+    if (tobj && node->GetMaterial() && uses.at(tobj) == 1) {
+        TriObj::MergeSource src;
+        src.mesh = tobj;
+        src.toWorld.Transform(tm);
+        src.mtlBase = 0;
+        src.useMeshMtls = false;
+        nodes.push_back(node);
+        sources.push_back(src);
+    }
+
+    for (int i = 0; i < node->GetNumChild(); i++) CollectStaticMeshes(node->GetChild(i), tm, uses, nodes, sources);
+}
+
+/*
+* Bakes every mesh that is referenced by a single node into one mesh with per-face material IDs and a single BVH.
+* The merged mesh is placed under the root with a multi-material that references the original node materials.
+* The original nodes keep their transformations and children, but no longer hold an object.
+*/
+void MergeStaticMeshes(Node& root, ObjFileList& objList, MaterialList& materials, BVHBuildParams const& bvhParams, TriangleLayout triLayout)
+{
+    std::map<Object const*, int> uses;
+    CountObjectUses(&root, uses);
+
+    std::vector<Node*> nodes;
+    std::vector<TriObj::MergeSource> sources;
+    Matrix34f identity;
+    identity.SetIdentity();
+    CollectStaticMeshes(&root, identity, uses, nodes, sources);
+    if (sources.size() < 2) return;
+
+    MultiMtl* mm = new MultiMtl(false);
+    for (size_t i = 0; i < sources.size(); i++) {
+        Material* mtl = const_cast<Material*>(nodes[i]->GetMaterial());
+        MultiMtl* objMtl = dynamic_cast<MultiMtl*>(mtl);
+        sources[i].mtlBase = mm->NumMaterials();
+        if (objMtl && sources[i].mesh->NM() > 0) {
+            // The OBJ materials of the mesh, keep them per face
+            sources[i].useMeshMtls = true;
+            for (int k = 0; k < objMtl->NumMaterials(); k++) mm->AppendMaterial(objMtl->GetMaterial(k));
+        }
+        else mm->AppendMaterial(mtl);
+    }
+
+    TriObj* merged = new TriObj;
+    if (!merged->Merge(sources, bvhParams, triLayout)) {
+        delete merged;
+        delete mm;
+        return;
+    }
+    merged->SetName("merged static meshes");
+    objList.push_back(merged);
+    mm->SetName("merged static meshes");
+    materials.push_back(mm);
+
+    Node* node = new Node;
+    node->SetName("merged static meshes");
+    node->SetNodeObj(merged);
+    node->SetMaterial(mm);
+    root.AppendChild(node);
+
+    // The merged meshes are no longer referenced by any node
+    for (size_t i = 0; i < sources.size(); i++) {
+        nodes[i]->SetNodeObj(nullptr);
+        TriObj* tobj = const_cast<TriObj*>(sources[i].mesh);
+        objList.erase(std::find(objList.begin(), objList.end(), tobj));
+        delete tobj;
+    }
+
+    printf("Merged %d static meshes: %u faces, %d materials, %u BVH nodes, SAH cost %.2f\n", (int)sources.size(), merged->NF(), mm->NumMaterials(), merged->GetBVHNodeCount(), merged->GetBVHCost());
+}
+
+//-------------------------------------------------------------------------------
+
+// A sphere node can join a sphere cloud if it has no children and its transformation is a uniform scale and a translation
+static bool GetCloudSphere(Node const* node, Vec3f& center, float& radius)
+{
+    if (node->GetNodeObj() != &theSphere || node->GetNumChild() > 0) return false;
+    center = node->TransformFrom(Vec3f(0, 0, 0));
+    radius = node->TransformFrom(Vec3f(1, 0, 0)).x - center.x;
+    if (radius <= 0.0f) return false;
+
+    const float tolerance = 1e-5f * radius;
+    for (int i = 0; i < 3; i++) {
+        Vec3f axis(0, 0, 0);
+        axis[i] = 1;
+        Vec3f scaled = node->TransformFrom(axis) - center;
+        for (int j = 0; j < 3; j++) if (fabsf(scaled[j] - (i == j ? radius : 0.0f)) > tolerance) return false;
+    }
+    return true;
+}
+
+static void ConvertSphereRuns(Node* node, ObjFileList& objList, MaterialList& materials, BVHBuildParams const& bvhParams, int minSpheres, int& numClouds, int& numSpheres)
+{
+    for (int i = 0; i < node->GetNumChild(); i++) ConvertSphereRuns(node->GetChild(i), objList, materials, bvhParams, minSpheres, numClouds, numSpheres);
+
+    std::vector<Vec3f> centers;
+    std::vector<float> radii;
+    for (int first = 0; first < node->GetNumChild(); first++) {
+        // Collect the run of sibling spheres starting here, spheres with and without a material are not mixed
+        centers.clear();
+        radii.clear();
+        const bool hasMtl = node->GetChild(first)->GetMaterial() != nullptr;
+        int end = first;
+        Vec3f c;
+        float r;
+        while (end < node->GetNumChild() && (node->GetChild(end)->GetMaterial() != nullptr) == hasMtl && GetCloudSphere(node->GetChild(end), c, r)) {
+            centers.push_back(c);
+            radii.push_back(r);
+            end++;
+        }
+        if (end - first < minSpheres) {
+            first = std::max(first, end - 1);
+            continue;
+        }
+
+        // One sub-material per distinct node material
+        std::map<Material const*, int> mtlIndex;
+        std::vector<int> mtlIDs(end - first);
+        MultiMtl* mm = new MultiMtl(false);
+        for (int k = first; k < end; k++) {
+            Material* mtl = const_cast<Material*>(node->GetChild(k)->GetMaterial());
+            auto it = mtlIndex.find(mtl);
+            if (it == mtlIndex.end()) {
+                it = mtlIndex.insert({ mtl, mm->NumMaterials() }).first;
+                mm->AppendMaterial(mtl);
+            }
+            mtlIDs[k - first] = it->second;
+        }
+        Material* cloudMtl = const_cast<Material*>(node->GetChild(first)->GetMaterial());
+        if (mm->NumMaterials() > 1) {
+            mm->SetName("sphere cloud");
+            materials.push_back(mm);
+            cloudMtl = mm;
+        }
+        else {
+            delete mm;
+            mtlIDs.clear();
+        }
+
+        SphereCloud* cloud = new SphereCloud;
+        cloud->Build(centers, radii, mtlIDs, bvhParams);
+        cloud->SetName("sphere cloud");
+        objList.push_back(cloud);
+
+        // The first node of the run holds the cloud, the others are removed
+        Node* cloudNode = node->GetChild(first);
+        cloudNode->InitTransform();
+        cloudNode->SetName("sphere cloud");
+        cloudNode->SetNodeObj(cloud);
+        cloudNode->SetMaterial(cloudMtl);
+        node->DeleteChildNodes(first + 1, end - first - 1);
+
+        numClouds++;
+        numSpheres += (int)centers.size();
+    }
+}
+
+/*
+* Replaces every run of at least minSpheres consecutive sibling sphere nodes that only differ by a uniform scale
+* and a translation with a single node holding a sphere cloud. Different node materials become sub-materials.
+*/
+void ConvertSphereRuns(Node& root, ObjFileList& objList, MaterialList& materials, BVHBuildParams const& bvhParams, int minSpheres)
+{
+    int numClouds = 0, numSpheres = 0;
+    ConvertSphereRuns(&root, objList, materials, bvhParams, std::max(minSpheres, 2), numClouds, numSpheres);
+    if (numClouds > 0) printf("Converted %d sphere nodes into %d sphere clouds\n", numSpheres, numClouds);
+}
+
+//-------------------------------------------------------------------------------
+
 Material* CreateMultiMtl(TextureFileList& texFiles, TriObj const* tobj)
 {
     // generate multi-material
@@ -55,7 +55,7 @@ public:
     };
 
     String Tag() const { return elem->Value(); }
-    String Attribute(char const* name) const { char const* s = nullptr; elem->QueryStringAttribute(name, &s); return String(s); }
+    String Attribute(char const* name) const { char const* s = nullptr; if (elem) elem->QueryStringAttribute(name, &s); return String(s); }
 
     bool ReadFloat(float& f, char const* name = "value") const { return elem && elem->QueryFloatAttribute(name, &f) == tinyxml2::XML_SUCCESS; }
     bool ReadInt(int& i, char const* name = "value") const { return elem && elem->QueryIntAttribute(name, &i) == tinyxml2::XML_SUCCESS; }